@@ -2,6 +2,7 @@
 #define MICTCP_CORE_H
 
 #include <mictcp.h>
+#include <api/mictcp_wire.h>
 #include <math.h>
 
 /**************************************************************
@@ -10,14 +11,34 @@
 
 int initialize_components(start_mode sm);
 
+int IP_resolve(mic_tcp_ip_addr, struct sockaddr_in*);
+int IP_source(struct sockaddr_in*); /* UDP source of the last datagram received by this thread */
 int IP_send(mic_tcp_pdu, mic_tcp_ip_addr);
+int IP_send_resolved(mic_tcp_pdu, const struct sockaddr_in*);
+void IP_send_batch_begin(void);
+int IP_flush(void);
 int IP_recv(mic_tcp_pdu* pk, mic_tcp_ip_addr* local_addr, mic_tcp_ip_addr* remote_addr, unsigned long timeout);
+int IP_recv_fd(void); /* descriptor IP_recv reads, -1 when listening threads own reception */
 int app_buffer_get(mic_tcp_payload);
-void app_buffer_put(mic_tcp_payload);
+int app_buffer_put(mic_tcp_payload);
+
+/* Receive rings: one per socket, app_buffer_get/put use a default one */
+typedef struct app_ring app_ring;
+app_ring* app_ring_new(int slot_size);
+void app_ring_destroy(app_ring*); /* no thread may use the ring any more */
+int app_ring_get(app_ring*, mic_tcp_payload);
+int app_ring_put(app_ring*, mic_tcp_payload);
+int app_ring_free(app_ring*); /* free slots, to be called by the producer */
+int app_ring_count(app_ring*); /* messages waiting, from any thread */
 
 void set_loss_rate(unsigned short);
+void get_recv_batch_stats(unsigned long* batches, unsigned long* datagrams);
+void get_send_stats(unsigned long* datagrams); /* datagrams handed to IP_send, lost or not */
+void get_syscall_stats(unsigned long* syscalls); /* system calls of the IP layer, sockets, io_uring or shared memory */
+const char* get_io_backend(void); /* "sockets", "uring", or "shm" once shared memory is in use; "sim" in simulation */
 unsigned long get_now_time_msec();
-unsigned long get_now_time_usec();
+unsigned long get_now_time_usec(); /* virtual clock in simulation (MICTCP_SIM) */
+void wait_until_usec(unsigned long date); /* sleeps until get_now_time_usec() reaches date */
 
 /**********************************************************************
  * Private core functions, should not be used for implementing mictcp *
@@ -28,7 +49,16 @@ unsigned long get_now_time_usec();
 #ifndef API_SC_Port
   #define API_SC_Port 8525
 #endif
-#define API_HD_Size 16
+#define API_HD_Size WIRE_BASE_SIZE /* header of a data PDU on the wire */
+#define IP_DATAGRAM_MAX 1500 /* largest datagram the listening thread receives */
+#define IP_PAYLOAD_MAX (IP_DATAGRAM_MAX - API_HD_Size) /* largest payload of a data PDU */
+#define IP_RECV_NOWAIT ((unsigned long) -1) /* IP_recv timeout: return at once if nothing is queued */
+#define MAX_SHARDS 64 /* max receive shards, see MICTCP_SHARDS */
+#define RECV_BATCH_SIZE 32 /* max datagrams taken by the listening thread per recvmmsg */
+#define SHM_ATTACH_RETRY_USEC 1000000 /* a client looks for the server's shared memory at most this often */
+#define SEND_BATCH_SIZE 32 /* max PDUs queued between IP_send_batch_begin() and IP_flush() */
+#define APP_BUFFER_SLOTS 256 /* capacity of the receive ring, in messages */
+#define APP_BUFFER_SLOT_SIZE 1500 /* initial size of each preallocated ring slot */
 
 typedef struct ip_payload
 {
@@ -37,10 +67,10 @@ typedef struct ip_payload
 } ip_payload;
 
 int mic_tcp_core_send(mic_tcp_payload);
-mic_tcp_payload get_full_stream(mic_tcp_pdu);
 mic_tcp_payload get_mic_tcp_data(ip_payload);
 mic_tcp_header get_mic_tcp_header(ip_payload);
 void* listening(void*);
+void* listening_shm(void*);
 void print_header(mic_tcp_pdu);
 
 int min_size(int, int);
@@ -0,0 +1,46 @@
+#ifndef MICTCP_EMU_H
+#define MICTCP_EMU_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/*
+ * Network emulation on the send path, configured by the MICTCP_EMU
+ * environment variable, a comma-separated list of key=value:
+ *
+ *   delay=ms       one-way delay added to every datagram
+ *   jitter=ms      uniform variation of the delay, +/- jitter (may reorder)
+ *   rate=kbit      token-bucket bandwidth limit, kbit/s (0 = unlimited)
+ *   bucket=bytes   token-bucket depth (default 3000)
+ *   queue=bytes    backlog allowed behind the bucket before tail drop (default 65536)
+ *   loss=%         loss probability, in the Gilbert-Elliott good state
+ *   ge_p=%         probability to move from the good to the bad state
+ *   ge_r=%         probability to move from the bad to the good state
+ *   ge_loss=%      loss probability in the bad state (default 100)
+ *   reorder=%      probability that a datagram skips the delay
+ *   dup=%          probability that a datagram is sent twice
+ *   seed=n         seed of the emulator's own random generator (default 1)
+ *
+ * Each process impairs what it sends; set MICTCP_EMU on both sides for a
+ * symmetric path. While the emulator is on, set_loss_rate() is ignored.
+ */
+
+#define EMU_ENV "MICTCP_EMU"
+
+int emu_init(void);   /* reads MICTCP_EMU, returns 1 if the emulator is on, -1 on a bad spec */
+int emu_active(void);
+
+/* Impairs and sends (now or later) the datagram described by msg on fd;
+   the data is copied, the caller's buffers can be reused on return.
+   Returns the datagram size, whether it was dropped or not */
+int emu_send(int fd, const struct msghdr* msg);
+
+#ifdef MICTCP_SIM
+/* Simulation build: the emulator is on even without MICTCP_EMU, has no
+   delivery thread and sends nothing. Pops the next datagram released no
+   later than date: its release date, destination and data (to be freed).
+   Returns its size, -1 if there is none */
+int emu_next(unsigned long date, unsigned long* release, struct sockaddr_in* dest, unsigned char** data);
+#endif
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef MICTCP_LOG_H
+#define MICTCP_LOG_H
+
+#include <stdio.h>
+
+/*
+ * Compile-time log levels. Anything above MICTCP_LOG_LEVEL expands to
+ * nothing, so release builds (make mode=release) pay no stdio cost on
+ * the hot path.
+ */
+#define MICTCP_LOG_NONE  0
+#define MICTCP_LOG_ERROR 1
+#define MICTCP_LOG_INFO  2
+#define MICTCP_LOG_DEBUG 3
+
+#ifndef MICTCP_LOG_LEVEL
+  #define MICTCP_LOG_LEVEL MICTCP_LOG_DEBUG
+#endif
+
+#if MICTCP_LOG_LEVEL >= MICTCP_LOG_ERROR
+  #define LOG_ERROR(...) printf(__VA_ARGS__)
+#else
+  #define LOG_ERROR(...) do { } while (0)
+#endif
+
+#if MICTCP_LOG_LEVEL >= MICTCP_LOG_INFO
+  #define LOG_INFO(...) printf(__VA_ARGS__)
+#else
+  #define LOG_INFO(...) do { } while (0)
+#endif
+
+#if MICTCP_LOG_LEVEL >= MICTCP_LOG_DEBUG
+  #define LOG_DEBUG(...) printf(__VA_ARGS__)
+#else
+  #define LOG_DEBUG(...) do { } while (0)
+#endif
+
+#endif
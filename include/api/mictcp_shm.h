@@ -0,0 +1,65 @@
+#ifndef MICTCP_SHM_H
+#define MICTCP_SHM_H
+
+/*
+ * Shared-memory backend of the IP layer, for a client and a server on the
+ * same host: MICTCP_IO=shm, or MICTCP_IO unset and a loopback server.
+ *
+ * The server maps mictcp-shm-<port>.bin in /dev/shm, SHM_SLOTS slots of
+ * two single-producer/single-consumer rings. A client claims one slot and
+ * writes its datagrams, encoded as on the wire, into the slot's ring to
+ * the server; the server answers through the ring to the client. One copy
+ * per datagram, into the ring, and no system call while both sides run.
+ *
+ * A sleeping peer costs one wakeup: the server's listening thread sleeps
+ * on a futex of the region, the client sleeps on its UDP socket (where
+ * IP_recv and mic_tcp_poll already wait), so the server rings it with an
+ * empty datagram. Everything else keeps going through UDP.
+ */
+
+#define SHM_SLOTS 64            /* clients served at once */
+#define SHM_RING_ENTRIES 256    /* datagrams per ring, a power of two */
+
+/* A datagram from a client; data points into its ring until shm_release */
+typedef struct shm_datagram
+{
+    unsigned char* data;
+    int size;
+    unsigned short port;    /* UDP port of the client, to answer it */
+    int slot;
+} shm_datagram;
+
+/* Server: creates the region of UDP port port. Returns -1 if another
+   server already serves it or the region cannot be created */
+int shm_serve(unsigned short port);
+
+/* Next datagram from any client, without a system call; -1 if none is ready */
+int shm_next(shm_datagram*);
+void shm_release(const shm_datagram*);
+
+/* Sleeps until a client writes, at most timeout usec (-1: no limit) */
+void shm_wait(long timeout);
+
+/* Writes a datagram for the client on UDP port port. Returns -1 if no
+   client of the region has that port, 1 if the client sleeps and must be
+   rung, 0 otherwise. A full ring drops the datagram, as UDP would */
+int shm_reply(unsigned short port, const unsigned char* header, int header_size,
+              const char* payload, int payload_size);
+
+/* Client: claims a slot in the region of the server on UDP port port,
+   for a client bound to UDP port own_port. Returns -1 if there is no
+   live server or no free slot */
+int shm_attach(unsigned short port, unsigned short own_port);
+
+/* Writes a datagram for the server; a full ring drops it */
+void shm_send(const unsigned char* header, int header_size, const char* payload, int payload_size);
+
+/* Copies the next datagram from the server, at most max bytes, without a
+   system call. When the ring is empty, returns -1 and asks the server to
+   ring at its next reply */
+int shm_recv(unsigned char* datagram, int max);
+int shm_pending(void); /* datagrams waiting for the client */
+
+unsigned long shm_syscalls(void); /* futex calls, both sides */
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef MICTCP_STATS_H
+#define MICTCP_STATS_H
+
+#include <mictcp.h>
+#include <stdint.h>
+
+/*
+ * Live counters export. With MICTCP_STATS=1 in the environment, the
+ * counters of socket fd live in slot fd of a shared page mapped from
+ * mictcp-stats-<pid>.bin (in $MICTCP_STATS_DIR or /dev/shm), so that
+ * build/mictcp_stat can poll them without stopping the process.
+ * The protocol updates them in place with relaxed atomics; readers load
+ * each counter with a relaxed atomic, there is no lock on either side.
+ */
+
+#define STATS_MAGIC "MICSTATS"
+#define STATS_VERSION 2
+#define STATS_SLOTS 1024 /* sockets exported, higher descriptors keep private counters */
+#define STATS_ENV "MICTCP_STATS"
+#define STATS_DIR_ENV "MICTCP_STATS_DIR"
+
+typedef struct stats_slot
+{
+    uint32_t used;          /* set once the socket exists */
+    uint16_t local_port;
+    uint16_t remote_port;   /* 0 until connected */
+    mic_tcp_stats stats;
+} stats_slot;
+
+/* On-disk layout: this header followed by STATS_SLOTS slots */
+typedef struct stats_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t slot_size;     /* sizeof(stats_slot), checked by readers */
+    int32_t pid;
+} stats_file_header;
+
+/* Counters of socket fd in the shared page, NULL if the export is off or fd is too high */
+mic_tcp_stats* stats_attach(int fd);
+void stats_detach(int fd); /* the socket is gone, readers skip its slot */
+void stats_describe(int fd, unsigned short local_port, unsigned short remote_port);
+
+/* Copies counters with relaxed atomic loads, from any thread or process */
+static inline void stats_read(const mic_tcp_stats* from, mic_tcp_stats* to)
+{
+    const unsigned long* src = (const unsigned long*) from;
+    unsigned long* dst = (unsigned long*) to;
+    for (unsigned int i = 0; i < sizeof(mic_tcp_stats) / sizeof(unsigned long); i++) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef MICTCP_TRACE_H
+#define MICTCP_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Binary event trace. When built with MICTCP_TRACE (make trace=1), each
+ * thread records fixed-size events in its own lock-free ring, mapped from
+ * a file named mictcp-trace-<pid>-<tid>.bin (in $MICTCP_TRACE_DIR or the
+ * current directory). The file stays readable even if the process is
+ * killed; build/trace_decode turns it back into text.
+ * Without MICTCP_TRACE, TRACE() compiles to nothing.
+ */
+
+#define TRACE_MAGIC "MICTRACE"
+#define TRACE_VERSION 1
+#define TRACE_RING_SIZE 65536 /* events per thread, power of two */
+
+typedef enum trace_event_id
+{
+    TRACE_IP_SEND = 1,      /* datagram handed to the kernel */
+    TRACE_IP_LOSS,          /* datagram dropped by the loss emulation */
+    TRACE_IP_RECV,          /* datagram received */
+    TRACE_PDU_SEND,         /* data PDU sent for the first time */
+    TRACE_PDU_RETRANSMIT,   /* data PDU sent again after a timeout */
+    TRACE_PDU_ABANDON,      /* data PDU loss tolerated, not retransmitted */
+    TRACE_ACK_RECV,         /* ACK processed by the sender */
+    TRACE_PDU_RECV,         /* data PDU processed by the receiver */
+    TRACE_APP_DELIVER,      /* payload handed to the app buffer */
+    TRACE_FEC_PARITY,       /* parity PDU sent (seq = first PDU of the group) */
+    TRACE_FEC_REPAIR,       /* data PDU rebuilt from parity by the receiver */
+    TRACE_EVENT_MAX
+} trace_event_id;
+
+typedef struct trace_event
+{
+    uint64_t timestamp; /* usec, get_now_time_usec() */
+    uint32_t event;     /* trace_event_id */
+    uint32_t seq;
+    uint32_t ack;
+    uint32_t size;
+} trace_event;
+
+/* On-disk layout: this header followed by TRACE_RING_SIZE events */
+typedef struct trace_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t tid;
+    uint32_t reserved;
+    uint64_t head;      /* number of events ever written, head % capacity is the next slot */
+} trace_file_header;
+
+#ifdef MICTCP_TRACE
+  void trace_record(uint32_t event, uint32_t seq, uint32_t ack, uint32_t size);
+  #define TRACE(event, seq, ack, size) trace_record((event), (seq), (ack), (size))
+#else
+  #define TRACE(event, seq, ack, size) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef MICTCP_URING_H
+#define MICTCP_URING_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/*
+ * io_uring backend of the IP layer, selected by MICTCP_IO=uring.
+ *
+ * A ring keeps one multishot recvmsg posted on its UDP socket: the kernel
+ * fills buffers taken from a provided buffer ring and posts one completion
+ * per datagram, without a system call per datagram. Sends are queued as
+ * sendmsg entries and go to the kernel with the next uring_wait, in the
+ * same system call that waits for datagrams.
+ *
+ * Raw system calls, no liburing. Needs Linux 6.0 (multishot recvmsg);
+ * uring_probe tells whether this kernel has everything.
+ */
+
+#define URING_ENV "MICTCP_IO"
+
+typedef struct uring uring;
+
+/* A received datagram; data points into a ring buffer until uring_release */
+typedef struct uring_datagram
+{
+    unsigned char* data;
+    int size;
+    struct sockaddr_in source;
+    unsigned short buffer;
+} uring_datagram;
+
+int uring_probe(void); /* 1 if this kernel runs the backend, 0 otherwise */
+
+/* Posts the multishot receive on fd, datagrams up to datagram_max bytes.
+   The calling thread runs the kernel's completion work for the receives:
+   at its next system call, or woken for it when it sleeps.
+   single_issuer: only the calling thread will use the ring.
+   Returns NULL on failure */
+uring* uring_open(int fd, int datagram_max, int single_issuer);
+void uring_close(uring*);
+int uring_fd(uring*); /* POLLIN when completions are waiting */
+
+/* Next received datagram, without a system call; -1 if none is ready */
+int uring_next(uring*, uring_datagram*);
+void uring_release(uring*, const uring_datagram*);
+
+/* Submits the queued sends and waits at most timeout usec (-1: no limit,
+   0: no wait) for a datagram. Returns -1 on error */
+int uring_wait(uring*, long timeout);
+
+/* Queues one sendmsg per message; the messages, their addresses and the
+   data they point to must stay valid until uring_settle returns */
+int uring_queue_sends(uring*, struct mmsghdr* msgs, int n);
+int uring_settle(uring*); /* submits the queued sends and waits for their completion */
+
+unsigned long uring_syscalls(void); /* io_uring_enter calls, all rings */
+
+#endif
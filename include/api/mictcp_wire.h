@@ -0,0 +1,146 @@
+#ifndef MICTCP_WIRE_H
+#define MICTCP_WIRE_H
+
+#include <mictcp.h>
+#include <string.h>
+
+/*
+ * On-the-wire MIC-TCP header: packed, network byte order, versioned.
+ *
+ *   byte  0        version (high nibble) | FEC parity index + 1 (low nibble)
+ *   byte  1        flags: SYN, ACK, FIN, OPT, then the segment flags
+ *   bytes 2-3      source port
+ *   bytes 4-5      destination port
+ *   bytes 6-9      seq_num
+ *   bytes 10-13    ack_num
+ *   bytes 14-15    rwnd, only when ACK is set
+ *   then, when OPT is set, TLV options (type, length, value) ended by a 0 byte
+ *
+ * A data PDU costs WIRE_BASE_SIZE bytes of header, an ACK two more.
+ * Encoding and decoding work in place on caller buffers, nothing is allocated.
+ */
+
+#define WIRE_VERSION 1
+#define WIRE_BASE_SIZE 14
+#define WIRE_RWND_SIZE 2
+#define WIRE_OPTIONS_MAX 40 /* TLV bytes, end marker excluded */
+#define WIRE_MAX_SIZE (WIRE_BASE_SIZE + WIRE_RWND_SIZE + WIRE_OPTIONS_MAX + 1)
+
+#define WIRE_SYN 0x01
+#define WIRE_ACK 0x02
+#define WIRE_FIN 0x04
+#define WIRE_OPT 0x08
+#define WIRE_SEG_SHIFT 4 /* SEG_SUITE, SEG_CONT and SEG_GROUPE use bits 4 to 6 */
+
+#define WIRE_OPT_END 0
+
+static inline void wire_put16(unsigned char* p, unsigned short v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static inline void wire_put32(unsigned char* p, unsigned int v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+static inline unsigned short wire_get16(const unsigned char* p)
+{
+    return (unsigned short) ((p[0] << 8) | p[1]);
+}
+
+static inline unsigned int wire_get32(const unsigned char* p)
+{
+    return ((unsigned int) p[0] << 24) | ((unsigned int) p[1] << 16) | ((unsigned int) p[2] << 8) | p[3];
+}
+
+/*
+ * Writes hd into buf, which holds at least WIRE_MAX_SIZE bytes
+ * Returns the length of the encoded header
+ */
+static inline int wire_encode(const mic_tcp_header* hd, unsigned char* buf)
+{
+    int len = WIRE_BASE_SIZE;
+    unsigned char flags = (hd->syn ? WIRE_SYN : 0) | (hd->ack ? WIRE_ACK : 0) | (hd->fin ? WIRE_FIN : 0)
+        | ((hd->segment & 0x07) << WIRE_SEG_SHIFT);
+    int options = (hd->taille_options > 0 && hd->taille_options <= WIRE_OPTIONS_MAX);
+
+    if (options) {
+        flags |= WIRE_OPT;
+    }
+    buf[0] = (WIRE_VERSION << 4) | (hd->fec & 0x0f);
+    buf[1] = flags;
+    wire_put16(buf + 2, hd->source_port);
+    wire_put16(buf + 4, hd->dest_port);
+    wire_put32(buf + 6, hd->seq_num);
+    wire_put32(buf + 10, hd->ack_num);
+    if (hd->ack) {
+        wire_put16(buf + len, hd->rwnd);
+        len += WIRE_RWND_SIZE;
+    }
+    if (options) {
+        memcpy(buf + len, hd->options, hd->taille_options);
+        len += hd->taille_options;
+        buf[len++] = WIRE_OPT_END;
+    }
+    return len;
+}
+
+/*
+ * Reads a header from the first len bytes of buf; hd->options then points
+ * into buf
+ * Returns the length of the header, or -1 if it is truncated, malformed
+ * or of another version
+ */
+static inline int wire_decode(const unsigned char* buf, int len, mic_tcp_header* hd)
+{
+    int pos = WIRE_BASE_SIZE;
+
+    if (len < WIRE_BASE_SIZE || (buf[0] >> 4) != WIRE_VERSION) {
+        return -1;
+    }
+    unsigned char flags = buf[1];
+    hd->fec = buf[0] & 0x0f;
+    hd->syn = (flags & WIRE_SYN) != 0;
+    hd->ack = (flags & WIRE_ACK) != 0;
+    hd->fin = (flags & WIRE_FIN) != 0;
+    hd->segment = (flags >> WIRE_SEG_SHIFT) & 0x07;
+    hd->source_port = wire_get16(buf + 2);
+    hd->dest_port = wire_get16(buf + 4);
+    hd->seq_num = wire_get32(buf + 6);
+    hd->ack_num = wire_get32(buf + 10);
+    hd->rwnd = 0;
+    hd->options = NULL;
+    hd->taille_options = 0;
+
+    if (hd->ack) {
+        if (len < pos + WIRE_RWND_SIZE) {
+            return -1;
+        }
+        hd->rwnd = wire_get16(buf + pos);
+        pos += WIRE_RWND_SIZE;
+    }
+    if (flags & WIRE_OPT) {
+        /* Unknown options are skipped by the protocol, only their framing is checked */
+        int start = pos;
+        while (pos < len && buf[pos] != WIRE_OPT_END) {
+            if (pos + 2 > len || pos + 2 + buf[pos + 1] > len) {
+                return -1;
+            }
+            pos += 2 + buf[pos + 1];
+        }
+        if (pos >= len || pos - start > WIRE_OPTIONS_MAX) {
+            return -1;
+        }
+        hd->options = buf + start;
+        hd->taille_options = pos - start;
+        pos++;
+    }
+    return pos;
+}
+
+#endif
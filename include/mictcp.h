@@ -13,6 +13,8 @@
 #include <netdb.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <mictcp_cc.h>
+#include <mictcp_fec.h>
 
 
 /*
@@ -48,8 +50,136 @@ typedef struct mic_tcp_sock_addr
     unsigned short port;
 } mic_tcp_sock_addr;
 
+/*
+ * Estimation du RTT d'une connexion et timeout de retransmission qui en
+ * découle (valeurs en microsecondes)
+ */
+typedef struct mic_tcp_rtt_info
+{
+  unsigned long srtt; /* RTT lissé */
+  unsigned long rttvar; /* variation du RTT */
+  unsigned long rto; /* timeout de retransmission courant */
+} mic_tcp_rtt_info;
+
+/*
+ * Compteurs d'une connexion, tenus à jour sur le chemin critique par des
+ * opérations atomiques relâchées (voir mic_tcp_get_stats)
+ */
+typedef struct mic_tcp_stats
+{
+  unsigned long pdu_envoyes; /* PDU de données émis, retransmissions comprises */
+  unsigned long octets_envoyes;
+  unsigned long retransmissions; /* PDU de données émis plus d'une fois */
+  unsigned long pertes_tolerees; /* PDU abandonnés par la fiabilité partielle */
+  unsigned long echeances_depassees; /* PDU abandonnés à leur échéance */
+  unsigned long parites_envoyees; /* PDU de parité FEC émis */
+  unsigned long acks_recus;
+  unsigned long pdu_recus; /* PDU de données et de parité reçus */
+  unsigned long octets_recus;
+  unsigned long doublons; /* PDU de données déjà reçus, ignorés */
+  unsigned long reparations; /* PDU reconstruits par la FEC */
+  unsigned long parites_ignorees; /* PDU de parité reçus sans FEC négociée */
+  unsigned long acks_envoyes;
+  unsigned long srtt; /* estimation courante du RTT (usec) */
+  unsigned long rto; /* usec */
+  unsigned long profondeur_buffer; /* messages en attente de mic_tcp_recv */
+} mic_tcp_stats;
+
+#define TAILLE_FENETRE 10 /* nombre d'envois mémorisés pour mesurer le taux de pertes */
+#define TAILLE_FENETRE_ENVOI_MAX 64 /* taille max de la fenêtre d'envoi et du buffer de réordonnancement */
+
+/*
+ * Drapeaux de segmentation : un message plus grand qu'un PDU est découpé
+ * en segments de numéros de séquence consécutifs
+ */
+#define SEG_SUITE 1 /* d'autres segments du message suivent */
+#define SEG_CONT 2 /* le PDU continue un message commencé dans le PDU précédent */
+#define SEG_GROUPE 4 /* le PDU regroupe plusieurs petits messages, chacun précédé de sa taille (2 octets) */
+
+/*
+ * Etat d'un emplacement de la fenêtre d'envoi
+ */
+typedef enum etat_pdu { LIBRE, EN_VOL, ACQUITTE, ABANDONNE } etat_pdu;
+
+/*
+ * PDU émis en attente d'acquittement (copie du message applicatif)
+ */
+typedef struct pdu_en_vol
+{
+  unsigned int seq; /* numéro de séquence du PDU */
+  char* data; /* copie des données applicatives */
+  int size; /* taille des données */
+  int capacite; /* taille allouée pour data */
+  unsigned long date_envoi; /* date de la dernière émission (usec) */
+  int nb_envois; /* nombre d'émissions du PDU */
+  unsigned long echeance; /* au-delà de cette date (usec) le message est inutile, 0 si aucune */
+  unsigned char segment; /* drapeaux de segmentation du PDU */
+  etat_pdu etat;
+} pdu_en_vol;
+
+/*
+ * Message copié par mic_tcp_send dans le tampon d'envoi, en attente du
+ * thread de protocole
+ */
+typedef struct message_en_attente
+{
+  char* data;
+  int size;
+  int capacite; /* taille allouée pour data */
+  unsigned long echeance; /* date (usec) au-delà de laquelle le message est inutile, 0 si aucune */
+} message_en_attente;
+
+/*
+ * PDU reçu hors séquence, en attente dans le buffer de réordonnancement
+ */
+typedef struct pdu_recu
+{
+  int present;
+  char* data;
+  int size;
+  int capacite;
+  unsigned char segment;
+} pdu_recu;
+
+struct app_ring;
+
+/*
+ * Charge utile des SYN et SYN-ACK : le SYN porte les paramètres proposés
+ * par le client, le SYN-ACK ceux retenus par le serveur
+ */
+typedef struct mic_tcp_negociation
+{
+  int loss_rate; /* taux de pertes toléré (%) */
+  unsigned char fec; /* FEC_AUCUN, FEC_XOR ou FEC_RS */
+  unsigned char fec_k; /* PDU de données par groupe */
+  unsigned char fec_m; /* PDU de parité par groupe */
+  unsigned char reserve;
+} mic_tcp_negociation;
+
+/*
+ * Thread bloqué dans mic_tcp_poll : un maillon par socket surveillé, qui
+ * réveillent tous le même eventfd
+ */
+typedef struct mic_tcp_attente
+{
+  int eventfd;
+  int* signale; /* l'eventfd a été écrit depuis le dernier réveil, commun aux maillons du thread */
+  struct mic_tcp_attente* suivant;
+} mic_tcp_attente;
+
+/*
+ * Socket surveillé par mic_tcp_poll, événements POLLIN et POLLOUT de <poll.h>
+ */
+typedef struct mic_tcp_pollfd
+{
+  int fd;
+  short events; /* demandés */
+  short revents; /* prêts, ou POLLNVAL si fd n'est pas un socket */
+} mic_tcp_pollfd;
+
 /*
  * Structure d'un socket
+ * Tout l'état protocolaire (séquencement, fenêtres, pertes) est propre au socket
  */
 typedef struct mic_tcp_sock
 {
@@ -57,6 +187,69 @@ typedef struct mic_tcp_sock
   protocol_state state; /* état du protocole */
   mic_tcp_sock_addr local_addr; /* adresse locale du socket */
   mic_tcp_sock_addr remote_addr; /* adresse distante du socket */
+  struct sockaddr_in remote_sockaddr; /* adresse distante résolue une seule fois à la connexion */
+  mic_tcp_rtt_info rtt; /* estimation du RTT de la connexion */
+  unsigned long rto_min; /* borne basse du RTO (usec) */
+  mic_tcp_stats* stats; /* compteurs : stats_locales, ou la page partagée si MICTCP_STATS=1 */
+  mic_tcp_stats stats_locales;
+
+  /* émission */
+  pthread_mutex_t verrou_envoi; /* protège l'émission entre l'application, le thread de protocole et le traitement des ACK */
+  unsigned int PE; /* prochain numéro de séquence à émettre */
+  unsigned int base_envoi; /* plus ancien numéro de séquence non acquitté */
+  int taille_fenetre_envoi; /* nombre max de PDU en vol */
+  pdu_en_vol* fenetre_envoi; /* PDU de numéro seq rangé à l'indice seq % TAILLE_FENETRE_ENVOI_MAX */
+  unsigned int plus_haut_acquitte; /* plus grand numéro acquitté sélectivement */
+  unsigned int fenetre_recepteur; /* dernière fenêtre annoncée par le récepteur (PDU) */
+  mic_tcp_cc cc; /* contrôle de congestion */
+  mic_tcp_fec fec; /* correction d'erreurs, négociée à l'établissement de la connexion */
+  unsigned long prochain_envoi; /* date au plus tôt du prochain envoi si le module lisse les émissions (usec) */
+  int regroupement; /* les petits messages sont regroupés tant qu'un PDU est en vol */
+  char* groupe; /* messages en attente de regroupement, au format d'un PDU SEG_GROUPE */
+  int taille_groupe;
+  int nb_groupe; /* nombre de messages dans groupe */
+
+  /* émission asynchrone */
+  message_en_attente* tampon_envoi; /* messages confiés au thread de protocole, NULL en mode synchrone */
+  int capacite_tampon; /* nombre de messages du tampon d'envoi */
+  unsigned int tete_tampon; /* prochain message à placer dans la fenêtre */
+  unsigned int queue_tampon; /* prochain emplacement libre */
+  int envoye_tete; /* octets du message de tête déjà placés dans la fenêtre */
+  int vidage; /* mic_tcp_flush : le groupe part sans attendre la fenêtre vide */
+  pthread_cond_t cond_envoi; /* de la place dans le tampon, ou tout est acquitté */
+  struct mic_tcp_sock* suivant_protocole; /* chaînage des sockets servis par le thread de protocole */
+
+  /* réception */
+  pthread_mutex_t verrou_reception; /* protège la réception entre le thread de réception et mic_tcp_recv */
+  unsigned int PA; /* prochain numéro de séquence attendu */
+  unsigned int base_emetteur; /* l'émetteur ne retransmettra plus les PDU précédant ce numéro */
+  int livraison_bloquee; /* des PDU attendent que l'application libère le buffer applicatif */
+  pdu_recu* tampon_reception; /* buffer de réordonnancement */
+  struct app_ring* reception; /* messages livrés, en attente de mic_tcp_recv */
+  char* message; /* message segmenté en cours de réassemblage */
+  int taille_message;
+  int capacite_message;
+  int reassemblage; /* un message segmenté est en cours de réassemblage */
+  int messages_livres; /* messages du PDU SEG_GROUPE attendu déjà livrés */
+
+  /* attente */
+  int non_bloquant; /* send, recv et accept échouent avec EAGAIN au lieu d'attendre */
+  pthread_mutex_t verrou_attentes;
+  mic_tcp_attente* attentes; /* threads bloqués dans mic_tcp_poll sur ce socket */
+
+  /* fiabilité partielle */
+  int fenetre[TAILLE_FENETRE]; /* succès (1) ou échec (0) des derniers envois */
+  int indice_fenetre;
+  int perte_tolere; /* taux de pertes toléré (%) */
+  mic_tcp_negociation negociation; /* paramètres retenus par le serveur, renvoyés dans chaque SYN-ACK */
+
+  struct mic_tcp_sock* suivant_hash; /* chaînage dans la table de démultiplexage */
+  struct mic_tcp_sock* ecoute; /* socket en écoute qui a créé cette connexion, NULL sinon */
+  struct mic_tcp_sock* file_accept; /* en écoute : connexions pas encore acceptées, la plus ancienne en tête */
+  int taille_file_accept; /* en écoute : connexions de la file, au plus FILE_ACCEPT_MAX */
+  struct mic_tcp_sock* suivant_accept; /* chaînage dans la file d'accept, ou des sockets à libérer */
+  unsigned long date_syn; /* réception du SYN (usec) : la poignée de main expire après DELAI_POIGNEE */
+  char ip_distante[INET_ADDRSTRLEN]; /* texte de remote_addr.ip_addr d'une connexion acceptée */
 } mic_tcp_sock;
 
 /*
@@ -69,7 +262,8 @@ typedef struct mic_tcp_payload
 } mic_tcp_payload;
 
 /*
- * Structure de l'entête d'un PDU MIC-TCP
+ * Structure de l'entête d'un PDU MIC-TCP, telle que manipulée par le
+ * protocole ; son encodage sur le réseau est défini dans api/mictcp_wire.h
  */
 typedef struct mic_tcp_header
 {
@@ -80,6 +274,11 @@ typedef struct mic_tcp_header
   unsigned char syn; /* flag SYN (valeur 1 si activé et 0 si non) */
   unsigned char ack; /* flag ACK (valeur 1 si activé et 0 si non) */
   unsigned char fin; /* flag FIN (valeur 1 si activé et 0 si non) */
+  unsigned char fec; /* PDU de parité : indice de la parité dans son groupe + 1, 0 sinon */
+  unsigned char segment; /* drapeaux SEG_SUITE, SEG_CONT et SEG_GROUPE, 0 pour un message entier */
+  unsigned short rwnd; /* ACK : nombre de PDU que le récepteur peut encore accepter */
+  unsigned char taille_options; /* taille des options TLV, 0 si aucune */
+  const unsigned char* options; /* options TLV (type, longueur, valeur) */
 } mic_tcp_header;
 
 /*
@@ -107,8 +306,20 @@ int mic_tcp_bind(int socket, mic_tcp_sock_addr addr);
 int mic_tcp_accept(int socket, mic_tcp_sock_addr* addr);
 int mic_tcp_connect(int socket, mic_tcp_sock_addr addr);
 int mic_tcp_send (int socket, char* mesg, int mesg_size);
+int mic_tcp_send_deadline (int socket, char* mesg, int mesg_size, long ttl);
 int mic_tcp_recv (int socket, char* mesg, int max_mesg_size);
 void process_received_PDU(mic_tcp_pdu pdu, mic_tcp_ip_addr local_addr, mic_tcp_ip_addr remote_addr);
 int mic_tcp_close(int socket);
+int mic_tcp_set_send_window(int socket, int taille);
+int mic_tcp_set_rto_min(int socket, unsigned long usec);
+int mic_tcp_get_rtt_info(int socket, mic_tcp_rtt_info* info);
+int mic_tcp_get_stats(int socket, mic_tcp_stats* stats);
+int mic_tcp_set_cc(int socket, const char* module);
+int mic_tcp_set_fec(int socket, int mode, int k, int m);
+int mic_tcp_set_coalescing(int socket, int actif);
+int mic_tcp_flush(int socket);
+int mic_tcp_set_send_buffer(int socket, int taille);
+int mic_tcp_set_nonblocking(int socket, int actif);
+int mic_tcp_poll(mic_tcp_pollfd* fds, int nfds, int timeout);
 
 #endif
@@ -0,0 +1,65 @@
+#ifndef MICTCP_CC_H
+#define MICTCP_CC_H
+
+/*
+ * Contrôle de congestion côté émetteur
+ * La fenêtre de congestion (cwnd) est comptée en PDU, comme la fenêtre d'envoi.
+ * Un module fournit ses réactions aux évènements de la connexion ; le socket
+ * n'envoie jamais plus de min(cwnd, taille de la fenêtre d'envoi) PDU en vol.
+ */
+
+#define CC_CWND_INITIAL 10 /* fenêtre initiale (RFC 6928) */
+#define CC_CWND_MIN 1
+
+struct mic_tcp_cc;
+
+typedef struct mic_tcp_cc_ops
+{
+  const char* nom;
+  void (*init)(struct mic_tcp_cc* cc);
+  /* nb_acquittes PDU viennent d'être acquittés, rtt : dernier RTT lissé (usec) */
+  void (*on_ack)(struct mic_tcp_cc* cc, unsigned int nb_acquittes, unsigned long rtt, unsigned long now);
+  /* perte détectée par les acquittements sélectifs */
+  void (*on_loss)(struct mic_tcp_cc* cc, unsigned long now);
+  /* expiration du timer de retransmission */
+  void (*on_rto)(struct mic_tcp_cc* cc, unsigned long now);
+  /* nombre de PDU pouvant être en vol */
+  unsigned int (*cwnd)(struct mic_tcp_cc* cc);
+  /* délai minimal entre deux émissions (usec), NULL ou 0 : pas de lissage */
+  unsigned long (*pacing)(struct mic_tcp_cc* cc, unsigned long rtt);
+} mic_tcp_cc_ops;
+
+/*
+ * État de contrôle de congestion d'un socket
+ */
+typedef struct mic_tcp_cc
+{
+  const mic_tcp_cc_ops* ops;
+  double cwnd; /* fenêtre de congestion (PDU) */
+  double ssthresh; /* seuil de slow start (PDU) */
+  unsigned int fin_recuperation; /* une seule réduction par fenêtre : pertes avant ce numéro ignorées */
+  int en_recuperation;
+  unsigned long date_expiration; /* dernière réaction à une expiration (usec) */
+
+  /* CUBIC */
+  double w_max; /* fenêtre au moment de la dernière réduction */
+  double k; /* durée (s) pour revenir à w_max */
+  unsigned long debut_epoque; /* début de la phase d'évitement de congestion (usec), 0 si aucune */
+  double w_est; /* estimation de la fenêtre qu'aurait Reno (région TCP-friendly) */
+} mic_tcp_cc;
+
+extern const mic_tcp_cc_ops cc_reno;
+extern const mic_tcp_cc_ops cc_cubic;
+extern const mic_tcp_cc_ops cc_fixe;
+
+const mic_tcp_cc_ops* mic_tcp_cc_trouver(const char* nom);
+void mic_tcp_cc_init(mic_tcp_cc* cc, const mic_tcp_cc_ops* ops);
+
+/* Points d'entrée utilisés par l'émetteur, communs à tous les modules */
+void mic_tcp_cc_ack(mic_tcp_cc* cc, unsigned int nb_acquittes, unsigned int base_envoi, unsigned long rtt, unsigned long now);
+void mic_tcp_cc_perte(mic_tcp_cc* cc, unsigned int seq, unsigned int PE, unsigned long now);
+void mic_tcp_cc_expiration(mic_tcp_cc* cc, unsigned long date_envoi, unsigned int PE, unsigned long now);
+unsigned int mic_tcp_cc_fenetre(mic_tcp_cc* cc);
+unsigned long mic_tcp_cc_pacing(mic_tcp_cc* cc, unsigned long rtt);
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef MICTCP_FEC_H
+#define MICTCP_FEC_H
+
+/*
+ * Correction d'erreurs (FEC) : pour chaque groupe de k PDU de données
+ * consécutifs, l'émetteur envoie m PDU de parité ; le récepteur reconstruit
+ * jusqu'à m PDU perdus du groupe sans attendre de retransmission.
+ *
+ * Un symbole est la charge utile d'un PDU précédée de sa taille (13 bits)
+ * et de ses drapeaux de segmentation (3 bits), complétée par des zéros
+ * jusqu'à la taille du plus long symbole du groupe.
+ * Parité XOR : m = 1, somme des symboles. Reed-Solomon : la parité j est
+ * la somme des symboles pondérés par une matrice de Cauchy sur GF(256),
+ * dont toute sous-matrice carrée est inversible.
+ */
+
+#define FEC_AUCUN 0
+#define FEC_XOR 1
+#define FEC_RS 2
+
+#define FEC_K_MAX 32 /* PDU de données par groupe */
+#define FEC_M_MAX 8 /* PDU de parité par groupe */
+#define FEC_TAILLE_MAX 0x1fff /* taille max de la charge utile d'un PDU protégé */
+
+/*
+ * Groupe en cours de réception : symboles de données (indices 0..k-1)
+ * et de parité (indices k..k+m-1) reçus
+ */
+typedef struct fec_groupe
+{
+  unsigned int base; /* numéro de séquence du premier PDU du groupe */
+  int actif;
+  int repare; /* toutes les données sont disponibles */
+  unsigned char recu[FEC_K_MAX + FEC_M_MAX];
+  unsigned char* symbole[FEC_K_MAX + FEC_M_MAX];
+  int taille[FEC_K_MAX + FEC_M_MAX];
+  int capacite[FEC_K_MAX + FEC_M_MAX];
+} fec_groupe;
+
+/*
+ * PDU de données reconstruit (data pointe dans le groupe)
+ */
+typedef struct fec_repare
+{
+  unsigned int seq;
+  char* data;
+  int size;
+  unsigned char segment;
+} fec_repare;
+
+/*
+ * État FEC d'un socket
+ */
+typedef struct mic_tcp_fec
+{
+  int mode; /* FEC_AUCUN, FEC_XOR ou FEC_RS */
+  int k;
+  int m;
+
+  /* émission : parités du dernier groupe */
+  unsigned char* parite[FEC_M_MAX];
+  int capacite_parite[FEC_M_MAX];
+  int taille_parite; /* taille commune des symboles de parité */
+
+  /* réception : groupe de base b rangé à l'indice (b / k) % nb_groupes */
+  fec_groupe* groupes;
+  int nb_groupes;
+} mic_tcp_fec;
+
+int mic_tcp_fec_init(mic_tcp_fec* fec, int mode, int k, int m);
+void mic_tcp_fec_liberer(mic_tcp_fec* fec);
+
+/* Émission : calcule les m parités des k messages d'un groupe */
+void mic_tcp_fec_encoder(mic_tcp_fec* fec, char** data, const int* tailles, const unsigned char* segments);
+
+/* Réception : enregistre un symbole, puis reconstruit ce qui peut l'être
+   Retourne le nombre de PDU reconstruits placés dans repares (au plus m) */
+int mic_tcp_fec_donnee(mic_tcp_fec* fec, unsigned int seq, const char* data, int size, unsigned char segment, fec_repare* repares);
+int mic_tcp_fec_parite(mic_tcp_fec* fec, unsigned int base, int indice, const char* symbole, int size, fec_repare* repares);
+
+#endif
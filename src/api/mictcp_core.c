@@ -1,35 +1,342 @@
+#define _GNU_SOURCE /* recvmmsg, pthread_setaffinity_np */
 #include <api/mictcp_core.h>
+#include <api/mictcp_log.h>
+#include <api/mictcp_trace.h>
+#include <api/mictcp_emu.h>
+#include <api/mictcp_uring.h>
+#include <api/mictcp_shm.h>
 #include <sys/time.h>
-#include <sys/queue.h>
 #include <math.h>
 #include <time.h>
 #include <pthread.h>
 #include <strings.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <errno.h>
 
 /*****************
  * API Variables *
  *****************/
 int initialized = -1;
 int sys_socket;
-pthread_t listen_th;
-pthread_mutex_t lock;
 unsigned short  loss_rate = 0;
 struct sockaddr_in remote_addr;
 
-/* This is for the buffer */
-TAILQ_HEAD(tailhead, app_buffer_entry) app_buffer_head;
-struct tailhead *headp;
-struct app_buffer_entry {
-     mic_tcp_payload bf;
-     TAILQ_ENTRY(app_buffer_entry) entries;
+/* Receive shards (server only): each one owns a UDP socket bound to the
+   same port with SO_REUSEPORT and a listening thread. The kernel hashes
+   the peer address, so a connection always lands on the same shard. */
+typedef struct shard
+{
+    int index;
+    int socket;
+    pthread_t thread;
+} shard;
+
+static shard shards[MAX_SHARDS];
+static int nb_shards = 0;
+
+/* Socket used by this thread to send: a listening thread answers from its
+   own shard, every other thread uses sys_socket */
+static __thread int tx_socket = -1;
+
+/* Source of the last datagram received by this thread, see IP_source() */
+static __thread struct sockaddr_in rx_source;
+static __thread int rx_source_valid = 0;
+
+/* Receive timeout currently set on sys_socket (ms, 0 = blocking), so that
+   SO_RCVTIMEO is only updated when IP_recv is called with a new value */
+unsigned long rcv_timeout = 0;
+
+/* Batched reception counters, written by the listening thread only */
+unsigned long recv_batches = 0;
+unsigned long recv_datagrams = 0;
+
+/* Datagrams handed to IP_send_resolved, by any thread */
+unsigned long sent_datagrams = 0;
+
+/* System calls made by the IP layer, by any thread (see get_syscall_stats) */
+unsigned long ip_syscalls = 0;
+
+#ifdef MICTCP_SIM
+/* Simulation build (make sim): the client and the server run in one
+   thread, on a virtual clock. The network is the emulator's release heap:
+   a datagram for the server runs the protocol when it is released, one
+   for the client waits in sim_inbox until IP_recv takes it, as it would in
+   a socket buffer. Time only moves when IP_recv or wait_until_usec wait */
+#define SIM_EPOCH_USEC 1000000UL
+#define SIM_FOREVER ((unsigned long) -1)
+
+typedef struct sim_entry
+{
+    unsigned char* data;
+    int size;
+    struct sim_entry* next;
+} sim_entry;
+
+static unsigned long sim_clock = SIM_EPOCH_USEC;
+static sim_entry* sim_inbox = NULL;
+static sim_entry* sim_inbox_tail = NULL;
+static struct sockaddr_in sim_client;   /* source of every client datagram */
+static mic_tcp_ip_addr sim_local = { "localhost", sizeof("localhost") };
+
+static void deliver(unsigned char* datagram, int size, const struct sockaddr_in* source, mic_tcp_ip_addr local);
+#endif
+
+/* IP backends, chosen by MICTCP_IO */
+#define IO_SOCKETS 0
+#define IO_URING 1
+#define IO_AUTO 2   /* unset: shared memory with a server on this host, sockets otherwise */
+#define IO_SHM 3    /* same, but say so when the shared memory is not there */
+static int io_backend = IO_SOCKETS;
+
+/* io_uring backend (MICTCP_IO=uring): the client reads through rx_ring,
+   under rx_ring_lock; each listening thread owns the ring of its shard,
+   which also carries its ACKs */
+static uring* rx_ring = NULL;
+#ifndef MICTCP_SIM
+static pthread_mutex_t rx_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static __thread uring* shard_ring = NULL;
+
+/* Shared-memory backend: the server serves its region from a listening
+   thread of its own; a client attaches when it first sends to a server on
+   this host, a failed attempt is retried every SHM_ATTACH_RETRY_USEC.
+   shm_sleepers counts the client threads blocked on sys_socket */
+static int shm_serving = 0;
+static int shm_attached = 0;
+static unsigned long shm_next_attach = 0;
+static pthread_mutex_t shm_attach_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sockaddr_in shm_self;
+#ifndef MICTCP_SIM
+static int shm_sleepers = 0;
+#endif
+static pthread_t shm_thread;
+
+/* Transmit queue: between IP_send_batch_begin() and IP_flush(), IP_send
+   only queues the PDU (header encoded, payload referenced) and the whole
+   queue goes out with a single sendmmsg. One queue per thread. */
+typedef struct tx_entry
+{
+    unsigned char header[WIRE_MAX_SIZE];
+    int header_size;
+    struct sockaddr_in dest;
+    struct iovec iov[2];
+} tx_entry;
+
+static __thread int tx_batching = 0;
+static __thread int tx_count = 0;
+static __thread tx_entry tx_queue[SEND_BATCH_SIZE];
+static __thread struct mmsghdr tx_msgs[SEND_BATCH_SIZE];
+
+/* This is for the buffer: a fixed-capacity single-producer/single-consumer
+   ring between the listening thread (producer) and mic_tcp_recv (consumer).
+   Slots are reused, head and tail only ever grow. */
+typedef struct app_ring_slot
+{
+    char* data;
+    int size;
+    int capacity;
+} app_ring_slot;
+
+struct app_ring
+{
+    unsigned int head;  /* next slot to read, owned by the consumer */
+    unsigned int tail;  /* next slot to write, owned by the producer, futex word */
+    int waiting;        /* the consumer sleeps on tail */
+    app_ring_slot slots[APP_BUFFER_SLOTS];
 };
 
-/* Condition variable used for passive wait when buffer is empty */
-pthread_cond_t buffer_empty_cond;
+/* Ring behind app_buffer_get/put */
+static app_ring* default_ring = NULL;
 
 /*************************
  * Fonctions Utilitaires *
  *************************/
+static int shard_count(void)
+{
+    /* MICTCP_SHARDS=n, or 0 for one shard per online CPU */
+    const char* env = getenv("MICTCP_SHARDS");
+    int n = (env != NULL) ? atoi(env) : 1;
+
+    if (n <= 0) {
+        n = (env != NULL) ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    }
+    return (n > MAX_SHARDS) ? MAX_SHARDS : n;
+}
+
+static int open_shard_socket(void)
+{
+    int one = 1;
+    int fd;
+    struct sockaddr_in local_addr;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+        return -1;
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    memset((char *) &local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_port = htons(API_CS_Port);
+    local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *) &local_addr, sizeof(local_addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int select_backend(void)
+{
+    /* MICTCP_IO=sockets, uring or shm; unset, shared memory with a server
+       on this host and sockets otherwise. The emulator needs sockets */
+    const char* env = getenv(URING_ENV);
+
+    if (env == NULL) {
+        return emu_active() ? IO_SOCKETS : IO_AUTO;
+    }
+    if (strcmp(env, "sockets") == 0) {
+        return IO_SOCKETS;
+    }
+    if (strcmp(env, "shm") == 0) {
+        if (emu_active()) {
+            LOG_ERROR("[MICTCP-CORE] L'emulateur passe par les sockets, pas de memoire partagee\n");
+            return IO_SOCKETS;
+        }
+        return IO_SHM;
+    }
+    if (strcmp(env, "uring") != 0) {
+        LOG_ERROR("[MICTCP-CORE] %s invalide : %s\n", URING_ENV, env);
+        return IO_SOCKETS;
+    }
+    if (!uring_probe()) {
+        LOG_ERROR("[MICTCP-CORE] io_uring indisponible, retour aux sockets\n");
+        return IO_SOCKETS;
+    }
+    LOG_INFO("[MICTCP-CORE] Couche IP sur io_uring\n");
+    return IO_URING;
+}
+
+static void start_shards(void)
+{
+    /* MICTCP_PIN_SHARDS=1 pins shard i to CPU i (modulo the CPU count) */
+    const char* pin = getenv("MICTCP_PIN_SHARDS");
+    long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    for (i = 0; i < nb_shards; i++) {
+        pthread_create(&shards[i].thread, NULL, listening, &shards[i]);
+
+        if (pin != NULL && atoi(pin) != 0 && nb_cpus > 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % nb_cpus, &cpus);
+            if (pthread_setaffinity_np(shards[i].thread, sizeof(cpus), &cpus) != 0) {
+                LOG_ERROR("[MICTCP-CORE] Impossible de fixer le shard %d sur un CPU\n", i);
+            }
+        }
+    }
+}
+
+static void start_shm(void)
+{
+    if (io_backend < IO_AUTO) {
+        return;
+    }
+    if (shm_serve(API_CS_Port) == -1) {
+        if (io_backend == IO_SHM) {
+            LOG_ERROR("[MICTCP-CORE] Memoire partagee indisponible, retour aux sockets\n");
+        }
+        return;
+    }
+    shm_serving = 1;
+    pthread_create(&shm_thread, NULL, listening_shm, NULL);
+}
+
+/* Client: attaches to the region of the server, at most once per
+   SHM_ATTACH_RETRY_USEC. Returns whether the client is attached */
+static int shm_client_attach(void)
+{
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    unsigned long now = get_now_time_usec();
+
+    pthread_mutex_lock(&shm_attach_lock);
+    if (!shm_attached && now >= shm_next_attach) {
+        if (getsockname(sys_socket, (struct sockaddr *) &local, &len) == 0
+            && shm_attach(API_CS_Port, ntohs(local.sin_port)) == 0) {
+            /* Doorbells for the other reading threads go to our own socket */
+            memset(&shm_self, 0, sizeof(shm_self));
+            shm_self.sin_family = AF_INET;
+            shm_self.sin_port = local.sin_port;
+            shm_self.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            __atomic_store_n(&shm_attached, 1, __ATOMIC_RELEASE);
+            LOG_INFO("[MICTCP-CORE] Couche IP en memoire partagee avec le serveur\n");
+        } else {
+            if (io_backend == IO_SHM && shm_next_attach == 0) {
+                LOG_ERROR("[MICTCP-CORE] Memoire partagee du serveur indisponible, retour aux sockets\n");
+            }
+            shm_next_attach = now + SHM_ATTACH_RETRY_USEC;
+        }
+    }
+    pthread_mutex_unlock(&shm_attach_lock);
+    return shm_attached;
+}
+
+/* Sends through shared memory when dest is served there; returns 0 when
+   the datagram must go through UDP instead */
+static int send_shm(const unsigned char* header, int header_size, const mic_tcp_payload* payload, const struct sockaddr_in* dest)
+{
+    if (io_backend < IO_AUTO || (ntohl(dest->sin_addr.s_addr) >> 24) != IN_LOOPBACKNET) {
+        return 0;
+    }
+
+    if (nb_shards != 0) {
+        /* Server: only to a client of the region, rung if it sleeps */
+        int r;
+        if (!shm_serving || (r = shm_reply(ntohs(dest->sin_port), header, header_size, payload->data, payload->size)) == -1) {
+            return 0;
+        }
+        if (r == 1) {
+            __atomic_add_fetch(&ip_syscalls, 1, __ATOMIC_RELAXED);
+            sendto(sys_socket, NULL, 0, 0, (const struct sockaddr *) dest, sizeof(struct sockaddr_in));
+        }
+        return 1;
+    }
+
+    if (ntohs(dest->sin_port) != API_CS_Port
+        || (!__atomic_load_n(&shm_attached, __ATOMIC_ACQUIRE) && !shm_client_attach())) {
+        return 0;
+    }
+    shm_send(header, header_size, payload->data, payload->size);
+    return 1;
+}
+
+#ifdef MICTCP_SIM
+/* Both ends live in this process: no socket, no thread */
+static int sim_init(void)
+{
+    default_ring = app_ring_new(APP_BUFFER_SLOT_SIZE);
+
+    memset(&remote_addr, 0, sizeof(remote_addr));
+    remote_addr.sin_family = AF_INET;
+    remote_addr.sin_port = htons(API_CS_Port);
+    remote_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    sim_client = remote_addr;
+    sim_client.sin_port = htons(API_SC_Port);
+
+    LOG_INFO("[MICTCP-CORE] Simulation, horloge virtuelle\n");
+    initialized = 1;
+    return initialized;
+}
+#endif
+
 int initialize_components(start_mode mode)
 {
     int bnd;
@@ -37,25 +344,36 @@ int initialize_components(start_mode mode)
     struct sockaddr_in local_addr;
 
     if(initialized != -1) return initialized;
-    if((sys_socket = socket(AF_INET, SOCK_DGRAM, 0)) == -1) return -1;
-    else initialized = 1;
 
-    if((mode == SERVER) & (initialized != -1))
+    if (emu_init() == -1) {
+        return -1;
+    }
+#ifdef MICTCP_SIM
+    return sim_init();
+#endif
+    io_backend = select_backend();
+
+    if(mode == SERVER)
     {
-        TAILQ_INIT(&app_buffer_head);
-        pthread_cond_init(&buffer_empty_cond, 0);
-        memset((char *) &local_addr, 0, sizeof(local_addr));
-        local_addr.sin_family = AF_INET;
-        local_addr.sin_port = htons(API_CS_Port);
-        local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        bnd = bind(sys_socket, (struct sockaddr *) &local_addr, sizeof(local_addr));
-
-        if (bnd == -1)
+        int n = shard_count();
+
+        default_ring = app_ring_new(APP_BUFFER_SLOT_SIZE);
+
+        /* Shard 0's socket doubles as sys_socket for the application threads */
+        for (nb_shards = 0; nb_shards < n; nb_shards++) {
+            shards[nb_shards].index = nb_shards;
+            if ((shards[nb_shards].socket = open_shard_socket()) == -1) {
+                break;
+            }
+        }
+
+        if (nb_shards == 0)
         {
             initialized = -1;
         }
         else
         {
+            sys_socket = shards[0].socket;
             memset((char *) &remote_addr, 0, sizeof(remote_addr));
             remote_addr.sin_family = AF_INET;
             remote_addr.sin_port = htons(API_SC_Port);
@@ -68,6 +386,9 @@ int initialize_components(start_mode mode)
     }
     else
     {
+        if((sys_socket = socket(AF_INET, SOCK_DGRAM, 0)) == -1) return -1;
+        else initialized = 1;
+
         if(initialized != -1)
         {
             memset((char *) &remote_addr, 0, sizeof(remote_addr));
@@ -81,12 +402,24 @@ int initialize_components(start_mode mode)
             local_addr.sin_port = htons(API_SC_Port);
             local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
             bnd = bind(sys_socket, (struct sockaddr *) &local_addr, sizeof(local_addr));
+
+            /* Another client already holds the port: take an ephemeral one,
+               the server answers to whatever source it sees */
+            if (bnd == -1 && errno == EADDRINUSE) {
+                local_addr.sin_port = 0;
+                bind(sys_socket, (struct sockaddr *) &local_addr, sizeof(local_addr));
+            }
+
+            if (io_backend == IO_URING && (rx_ring = uring_open(sys_socket, IP_DATAGRAM_MAX, 0)) == NULL) {
+                LOG_ERROR("[MICTCP-CORE] io_uring indisponible, retour aux sockets\n");
+            }
         }
     }
 
     if((initialized == 1) && (mode == SERVER))
     {
-        pthread_create (&listen_th, NULL, listening, "1");
+        start_shards();
+        start_shm();
     }
 
     return initialized;
@@ -94,75 +427,404 @@ int initialize_components(start_mode mode)
 
 
 
+int IP_resolve(mic_tcp_ip_addr addr, struct sockaddr_in* dest)
+{
+    struct addrinfo hints;
+    struct addrinfo* res;
+
+    if(initialized == -1) {
+        return -1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    /* getaddrinfo is reentrant, unlike gethostbyname */
+    if (addr.addr == NULL || getaddrinfo(addr.addr, NULL, &hints, &res) != 0) {
+        return -1;
+    }
+
+    /* The peer port is fixed by the core, only the host comes from addr */
+    memcpy(dest, &remote_addr, sizeof(struct sockaddr_in));
+    dest->sin_addr = ((struct sockaddr_in *) res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+
+    return 0;
+}
+
+int IP_source(struct sockaddr_in* dest)
+{
+    if (!rx_source_valid) {
+        return -1;
+    }
+    memcpy(dest, &rx_source, sizeof(struct sockaddr_in));
+    return 0;
+}
+
 int IP_send(mic_tcp_pdu pk, mic_tcp_ip_addr addr)
+{
+    struct sockaddr_in dest;
+
+    if (IP_resolve(addr, &dest) == -1) {
+        return -1;
+    }
+    return IP_send_resolved(pk, &dest);
+}
+
+int IP_send_resolved(mic_tcp_pdu pk, const struct sockaddr_in* dest)
 {
 
     int result = -1;
     int random = rand();
     int lr_tresh = (int) round(((float)loss_rate/100.0)*RAND_MAX);
-    struct hostent * hp;
 
     if(initialized == -1) {
         result = -1;
 
     } else {
-        mic_tcp_payload tmp = get_full_stream(pk);
-        int sent_size = tmp.size;
-
-        if(random > lr_tresh) {
-           hp = gethostbyname(addr.addr);
-           memcpy (&(remote_addr.sin_addr.s_addr), hp->h_addr, hp->h_length);
-           sent_size = sendto(sys_socket, tmp.data, tmp.size, 0, (struct sockaddr *)&remote_addr, sizeof(struct sockaddr));
-           printf("[MICTCP-CORE] Envoi d'un paquet IP de taille %d vers l'adresse %s\n", sent_size, addr.addr);
+        unsigned char header[WIRE_MAX_SIZE];
+        int header_size = wire_encode(&pk.header, header);
+        int sent_size = header_size + pk.payload.size;
+
+        __atomic_add_fetch(&sent_datagrams, 1, __ATOMIC_RELAXED);
+
+        /* The emulator replaces the loss rate and copies what it delays */
+        if(emu_active() || random > lr_tresh) {
+           if (send_shm(header, header_size, &pk.payload, dest)) {
+               /* Straight into the peer's ring, the payload is copied once */
+               TRACE(TRACE_IP_SEND, pk.header.seq_num, pk.header.ack_num, pk.payload.size);
+               LOG_DEBUG("[MICTCP-CORE] Envoi d'un paquet IP de taille %d en memoire partagee\n", sent_size);
+           } else if (tx_batching && !emu_active()) {
+               /* Queue it, the payload must stay valid until IP_flush() */
+               if (tx_count == SEND_BATCH_SIZE) {
+                   IP_flush();
+                   tx_batching = 1;
+               }
+               /* The ring may still be sending the previous batch from the queue */
+               if (tx_count == 0 && shard_ring != NULL) {
+                   uring_settle(shard_ring);
+               }
+               tx_entry* entry = &tx_queue[tx_count++];
+               memcpy(entry->header, header, header_size);
+               entry->header_size = header_size;
+               entry->dest = *dest;
+               entry->iov[1].iov_base = pk.payload.data;
+               entry->iov[1].iov_len = pk.payload.size;
+               TRACE(TRACE_IP_SEND, pk.header.seq_num, pk.header.ack_num, pk.payload.size);
+           } else {
+               /* Gather header and payload straight from the caller's memory:
+                  no intermediate buffer, the payload is never copied */
+               struct iovec iov[2];
+               struct msghdr msg;
+
+               iov[0].iov_base = header;
+               iov[0].iov_len = header_size;
+               iov[1].iov_base = pk.payload.data;
+               iov[1].iov_len = pk.payload.size;
+
+               memset(&msg, 0, sizeof(msg));
+               msg.msg_name = (void *) dest;
+               msg.msg_namelen = sizeof(struct sockaddr_in);
+               msg.msg_iov = iov;
+               msg.msg_iovlen = (pk.payload.size > 0) ? 2 : 1;
+
+               __atomic_add_fetch(&ip_syscalls, 1, __ATOMIC_RELAXED);
+               if (emu_active()) {
+                   sent_size = emu_send((tx_socket != -1) ? tx_socket : sys_socket, &msg);
+               } else {
+                   sent_size = sendmsg((tx_socket != -1) ? tx_socket : sys_socket, &msg, 0);
+               }
+               TRACE(TRACE_IP_SEND, pk.header.seq_num, pk.header.ack_num, pk.payload.size);
+               LOG_DEBUG("[MICTCP-CORE] Envoi d'un paquet IP de taille %d vers l'adresse %s\n", sent_size, inet_ntoa(dest->sin_addr));
+           }
         } else {
-           printf("[MICTCP-CORE] Perte du paquet\n");
+           TRACE(TRACE_IP_LOSS, pk.header.seq_num, pk.header.ack_num, pk.payload.size);
+           LOG_DEBUG("[MICTCP-CORE] Perte du paquet\n");
         }
 
-        free (tmp.data);
-
         /* Correct the sent size */
-        result = (sent_size == -1) ? -1 : sent_size - API_HD_Size;
+        result = (sent_size == -1) ? -1 : sent_size - header_size;
+    }
+
+    return result;
+}
+
+void IP_send_batch_begin(void)
+{
+    tx_batching = 1;
+}
+
+int IP_flush(void)
+{
+    int i;
+    int sent = 0;
+    int ret = 0;
+
+    tx_batching = 0;
+
+    if (tx_count == 0) {
+        return 0;
+    }
+
+    for (i = 0; i < tx_count; i++) {
+        tx_entry* entry = &tx_queue[i];
+        entry->iov[0].iov_base = entry->header;
+        entry->iov[0].iov_len = entry->header_size;
+        memset(&(tx_msgs[i].msg_hdr), 0, sizeof(struct msghdr));
+        tx_msgs[i].msg_hdr.msg_name = &(entry->dest);
+        tx_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        tx_msgs[i].msg_hdr.msg_iov = entry->iov;
+        tx_msgs[i].msg_hdr.msg_iovlen = (entry->iov[1].iov_len > 0) ? 2 : 1;
+    }
+
+    /* A listening thread on io_uring leaves them to its next wait */
+    if (shard_ring != NULL) {
+        sent = uring_queue_sends(shard_ring, tx_msgs, tx_count);
+        LOG_DEBUG("[MICTCP-CORE] Envoi groupé de %d paquets IP\n", sent);
+        tx_count = 0;
+        return sent;
+    }
+
+    /* sendmmsg may stop early, keep going until the queue is empty */
+    while (sent < tx_count) {
+        __atomic_add_fetch(&ip_syscalls, 1, __ATOMIC_RELAXED);
+        ret = sendmmsg((tx_socket != -1) ? tx_socket : sys_socket, tx_msgs + sent, tx_count - sent, 0);
+        if (ret == -1) {
+            break;
+        }
+        sent += ret;
+    }
+
+    LOG_DEBUG("[MICTCP-CORE] Envoi groupé de %d paquets IP\n", sent);
+
+    tx_count = 0;
+    return (ret == -1) ? -1 : sent;
+}
+
+#ifndef MICTCP_SIM
+/* IP_recv through the client's ring: the datagram is copied out of its
+   buffer, which goes straight back to the kernel */
+static int ring_recv(unsigned char* datagram, struct sockaddr_in* source, unsigned long timeout)
+{
+    unsigned long deadline = 0;
+    uring_datagram d;
+    int result;
+
+    if (timeout == IP_RECV_NOWAIT) {
+        /* Another thread is reading: whatever is queued is its to take */
+        if (pthread_mutex_trylock(&rx_ring_lock) != 0) {
+            return -1;
+        }
+        uring_wait(rx_ring, 0);
+    } else if (timeout == 0) {
+        pthread_mutex_lock(&rx_ring_lock);
+    } else {
+        deadline = get_now_time_usec() + timeout * 1000;
+        struct timespec until = { deadline / 1000000, (deadline % 1000000) * 1000 };
+        if (pthread_mutex_timedlock(&rx_ring_lock, &until) != 0) {
+            return -1;
+        }
+    }
+
+    while ((result = uring_next(rx_ring, &d)) == -1 && timeout != IP_RECV_NOWAIT) {
+        unsigned long now = get_now_time_usec();
+        if (deadline != 0 && now >= deadline) {
+            break;
+        }
+        if (uring_wait(rx_ring, (deadline != 0) ? (long) (deadline - now) : -1) == -1) {
+            break;
+        }
+    }
+
+    if (result != -1) {
+        result = min_size(result, IP_DATAGRAM_MAX);
+        memcpy(datagram, d.data, result);
+        *source = d.source;
+        uring_release(rx_ring, &d);
+    }
+    pthread_mutex_unlock(&rx_ring_lock);
+    return result;
+}
+
+/* IP_recv on sys_socket. Once attached to the server's region, the
+   server's datagrams come from the ring, and an empty datagram on the
+   socket is only its doorbell */
+static int socket_recv(struct msghdr* msg, struct sockaddr_in* source, unsigned long timeout)
+{
+    int attached = __atomic_load_n(&shm_attached, __ATOMIC_ACQUIRE);
+    int rung = 0;
+    int result;
+
+    /* Only touch the socket option when the timeout actually changes */
+    if (timeout != IP_RECV_NOWAIT && timeout != rcv_timeout) {
+        struct timeval tv;
+        __atomic_add_fetch(&ip_syscalls, 1, __ATOMIC_RELAXED);
+        /* Compute the number of entire seconds */
+        tv.tv_sec = timeout / 1000;
+        /* Convert the remainder to microseconds */
+        tv.tv_usec = (timeout - tv.tv_sec * 1000) * 1000;
+
+        if ((setsockopt(sys_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))) < 0) {
+            return -1;
+        }
+        rcv_timeout = timeout;
+    }
+
+    while (1) {
+        if (attached && (result = shm_recv(msg->msg_iov->iov_base, msg->msg_iov->iov_len)) != -1) {
+            /* The doorbell we took may be the one another sleeping thread needs */
+            if (rung && __atomic_load_n(&shm_sleepers, __ATOMIC_RELAXED) > 0 && shm_pending() > 0) {
+                __atomic_add_fetch(&ip_syscalls, 1, __ATOMIC_RELAXED);
+                sendto(sys_socket, NULL, 0, 0, (struct sockaddr *) &shm_self, sizeof(shm_self));
+            }
+            *source = remote_addr;
+            return result;
+        }
+
+        __atomic_add_fetch(&ip_syscalls, 1, __ATOMIC_RELAXED);
+        if (timeout == IP_RECV_NOWAIT) {
+            result = recvmsg(sys_socket, msg, MSG_DONTWAIT);
+        } else {
+            __atomic_add_fetch(&shm_sleepers, attached, __ATOMIC_RELAXED);
+            result = recvmsg(sys_socket, msg, 0);
+            __atomic_sub_fetch(&shm_sleepers, attached, __ATOMIC_RELAXED);
+        }
+        if (result != 0 || !attached) {
+            return result;
+        }
+        rung = 1;
     }
+}
+
+#else
+/* Runs the simulated network up to date (SIM_FOREVER: until it is idle).
+   Datagrams for the server run the protocol as they are released, the
+   ones for the client are queued for IP_recv; with for_client, stops at
+   the first of those. Returns whether the client has a datagram waiting */
+static int sim_run(unsigned long date, int for_client)
+{
+    struct sockaddr_in dest;
+    unsigned long release;
+    unsigned char* data;
+    int size;
+
+    while (!(for_client && sim_inbox != NULL)
+           && (size = emu_next(date, &release, &dest, &data)) != -1) {
+        if (release > sim_clock) {
+            sim_clock = release;
+        }
+        if (ntohs(dest.sin_port) == API_CS_Port) {
+            deliver(data, size, &sim_client, sim_local);
+            free(data);
+        } else {
+            sim_entry* e = malloc(sizeof(sim_entry));
+            if (e == NULL) {
+                free(data);
+                continue;
+            }
+            e->data = data;
+            e->size = size;
+            e->next = NULL;
+            if (sim_inbox == NULL) {
+                sim_inbox = e;
+            } else {
+                sim_inbox_tail->next = e;
+            }
+            sim_inbox_tail = e;
+        }
+    }
+    if (!(for_client && sim_inbox != NULL) && date != SIM_FOREVER && date > sim_clock) {
+        /* Nothing happens before date: time jumps there */
+        sim_clock = date;
+    }
+    return sim_inbox != NULL;
+}
 
+/* IP_recv on the client side of the simulation */
+static int sim_recv(unsigned char* datagram, struct sockaddr_in* source, unsigned long timeout)
+{
+    unsigned long date;
+    sim_entry* e;
+    int result;
+
+    if (timeout == IP_RECV_NOWAIT) {
+        date = sim_clock;
+    } else if (timeout == 0) {
+        date = SIM_FOREVER;
+    } else {
+        date = sim_clock + timeout * 1000;
+    }
+    if (!sim_run(date, 1)) {
+        return -1;
+    }
+
+    e = sim_inbox;
+    sim_inbox = e->next;
+    result = min_size(e->size, IP_DATAGRAM_MAX);
+    memcpy(datagram, e->data, result);
+    free(e->data);
+    free(e);
+    *source = remote_addr;
     return result;
 }
+#endif
 
 int IP_recv(mic_tcp_pdu* pk, mic_tcp_ip_addr* local_addr, mic_tcp_ip_addr* remote_addr, unsigned long timeout)
 {
     int result = -1;
 
-    struct timeval tv;
     struct sockaddr_in tmp_addr;
-    socklen_t tmp_addr_size = sizeof(struct sockaddr);
+    struct iovec iov;
+    struct msghdr msg;
+    unsigned char datagram[IP_DATAGRAM_MAX];
+    int header_size = -1;
 
     /* Send data over a fake IP */
     if(initialized == -1) {
         return -1;
     }
 
-    /* Compute the number of entire seconds */
-    tv.tv_sec = timeout / 1000;
-    /* Convert the remainder to microseconds */
-    tv.tv_usec = (timeout - tv.tv_sec * 1000) * 1000;
-
-    /* Create a reception buffer */
-    int buffer_size = API_HD_Size + pk->payload.size;
-    char *buffer = malloc(buffer_size);
+    /* The header length varies, so the datagram lands in a local buffer;
+       IP_recv only carries control PDUs, whose payload is small or empty */
+    iov.iov_base = datagram;
+    iov.iov_len = sizeof(datagram);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &tmp_addr;
+    msg.msg_namelen = sizeof(tmp_addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+#ifdef MICTCP_SIM
+    result = sim_recv(datagram, &tmp_addr, timeout);
+#else
+    if (rx_ring != NULL) {
+        result = ring_recv(datagram, &tmp_addr, timeout);
+    } else {
+        result = socket_recv(&msg, &tmp_addr, timeout);
+    }
+#endif
 
-    if ((setsockopt(sys_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))) >= 0) {
-       result = recvfrom(sys_socket, buffer, buffer_size, 0, (struct sockaddr *)&tmp_addr, &tmp_addr_size);
+    if (result != -1 && (header_size = wire_decode(datagram, result, &(pk->header))) == -1) {
+        /* Not a valid header, drop it */
+        result = -1;
     }
 
     if (result != -1) {
-        /* Create the mic_tcp_pdu */
-        memcpy (&(pk->header), buffer, API_HD_Size);
-        pk->payload.size = result - API_HD_Size;
-        memcpy (pk->payload.data, buffer + API_HD_Size, pk->payload.size);
+        result = min_size(result - header_size, (pk->payload.size > 0) ? pk->payload.size : 0);
+        memcpy(pk->payload.data, datagram + header_size, result);
+        pk->payload.size = result;
+        rx_source = tmp_addr;
+        rx_source_valid = 1;
 
-        /* Generate a stub address */
+        /* Report the sender address, or a stub if the caller gave no buffer */
         if (remote_addr != NULL) {
-            //inet_ntop(AF_INET, &(tmp_addr.sin_addr),remote_addr->addr,remote_addr->addr_size);
-            remote_addr->addr = "localhost";
+            if (remote_addr->addr != NULL && remote_addr->addr_size >= INET_ADDRSTRLEN) {
+                inet_ntop(AF_INET, &(tmp_addr.sin_addr),remote_addr->addr,remote_addr->addr_size);
+            } else {
+                remote_addr->addr = "localhost";
+            }
             remote_addr->addr_size = strlen(remote_addr->addr) + 1; // don't forget '\0'
         }
 
@@ -171,38 +833,38 @@ int IP_recv(mic_tcp_pdu* pk, mic_tcp_ip_addr* local_addr, mic_tcp_ip_addr* remot
             local_addr->addr_size = strlen(local_addr->addr) + 1; // don't forget '\0'
         }
 
-        printf("[MICTCP-CORE] Réception d'un paquet IP de taille %d provenant de %s\n", result, remote_addr->addr);
-
-        /* Correct the receved size */
-        result -= API_HD_Size;
-
+        TRACE(TRACE_IP_RECV, pk->header.seq_num, pk->header.ack_num, result);
+        LOG_DEBUG("[MICTCP-CORE] Réception d'un paquet IP de taille %d provenant de %s\n", header_size + result, inet_ntoa(tmp_addr.sin_addr));
     }
 
-    /* Free the reception buffer */
-    free(buffer);
-
     return result;
 }
 
-mic_tcp_payload get_full_stream(mic_tcp_pdu pk)
+int IP_recv_fd(void)
 {
-    /* Get a full packet from data and header */
-    mic_tcp_payload tmp;
-    tmp.size = API_HD_Size + pk.payload.size;
-    tmp.data = malloc (tmp.size);
-
-    memcpy (tmp.data, &pk.header, API_HD_Size);
-    memcpy (tmp.data + API_HD_Size, pk.payload.data, pk.payload.size);
-
-    return tmp;
+#ifdef MICTCP_SIM
+    /* Nothing to poll: the simulation only runs inside IP_recv */
+    return -1;
+#endif
+    /* On a server, the shards' listening threads read every datagram;
+       on io_uring, the ring is readable when a datagram is waiting */
+    if (initialized != 1 || nb_shards != 0) {
+        return -1;
+    }
+    return (rx_ring != NULL) ? uring_fd(rx_ring) : sys_socket;
 }
 
 mic_tcp_payload get_mic_tcp_data(ip_payload buff)
 {
     mic_tcp_payload tmp;
-    tmp.size = buff.size-API_HD_Size;
+    mic_tcp_header hd;
+    int header_size = wire_decode((unsigned char *) buff.data, buff.size, &hd);
+    if (header_size == -1) {
+        header_size = buff.size;
+    }
+    tmp.size = buff.size - header_size;
     tmp.data = malloc(tmp.size);
-    memcpy(tmp.data, buff.data+API_HD_Size, tmp.size);
+    memcpy(tmp.data, buff.data + header_size, tmp.size);
     return tmp;
 }
 
@@ -211,114 +873,307 @@ mic_tcp_header get_mic_tcp_header(ip_payload packet)
 {
     /* Get a struct header from an incoming packet */
     mic_tcp_header tmp;
-    memcpy(&tmp, packet.data, API_HD_Size);
+    if (wire_decode((unsigned char *) packet.data, packet.size, &tmp) == -1) {
+        memset(&tmp, 0, sizeof(tmp));
+    }
     return tmp;
 }
 
 
 
-int app_buffer_get(mic_tcp_payload app_buff)
+app_ring* app_ring_new(int slot_size)
 {
-    /* A pointer to a buffer entry */
-    struct app_buffer_entry * entry;
+    /* slot_size == 0 leaves the slots empty until their first use,
+       which keeps idle sockets cheap */
+    app_ring* ring = calloc(1, sizeof(app_ring));
+
+    if (ring != NULL && slot_size > 0) {
+        for (int i = 0; i < APP_BUFFER_SLOTS; i++) {
+            ring->slots[i].data = malloc(slot_size);
+            ring->slots[i].capacity = slot_size;
+        }
+    }
+    return ring;
+}
+
+void app_ring_destroy(app_ring* ring)
+{
+    if (ring == NULL) {
+        return;
+    }
+    for (int i = 0; i < APP_BUFFER_SLOTS; i++) {
+        free(ring->slots[i].data);
+    }
+    free(ring);
+}
+
+int app_ring_get(app_ring* ring, mic_tcp_payload app_buff)
+{
+    unsigned int head = ring->head;
+    unsigned int tail;
 
     /* The actual size passed to the application */
     int result = 0;
 
-    /* Lock a mutex to protect the buffer from corruption */
-    pthread_mutex_lock(&lock);
-
-    /* If the buffer is empty, we wait for insertion */
-    while(app_buffer_head.tqh_first == NULL) {
-          pthread_cond_wait(&buffer_empty_cond, &lock);
+    /* If the buffer is empty, we sleep until the producer moves the tail */
+    while ((tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) == head) {
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head) {
+            syscall(SYS_futex, &ring->tail, FUTEX_WAIT_PRIVATE, head, NULL, NULL, 0);
+        }
+        __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
     }
 
-    /* When we execute the code below, the following conditions are true:
-       - The buffer contains at least 1 element
-       - We hold the lock on the mutex
-    */
-
-    /* The entry we want is the first one in the buffer */
-    entry = app_buffer_head.tqh_first;
+    /* The entry we want is the oldest one in the ring */
+    app_ring_slot* slot = &ring->slots[head % APP_BUFFER_SLOTS];
 
     /* How much data are we going to deliver to the application ? */
-    result = min_size(entry->bf.size, app_buff.size);
+    result = min_size(slot->size, app_buff.size);
 
     /* We copy the actual data in the application allocated buffer */
-    memcpy(app_buff.data, entry->bf.data, result);
+    memcpy(app_buff.data, slot->data, result);
 
-    /* We remove the entry from the buffer */
-    TAILQ_REMOVE(&app_buffer_head, entry, entries);
+    /* Hand the slot back to the producer */
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
 
-    /* Release the mutex */
-    pthread_mutex_unlock(&lock);
+    return result;
+}
 
-    /* Clean up memory */
-    free(entry->bf.data);
-    free(entry);
+int app_ring_put(app_ring* ring, mic_tcp_payload bf)
+{
+    unsigned int tail = ring->tail;
 
-    return result;
+    /* The ring is full, the caller must not consider the data delivered */
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == APP_BUFFER_SLOTS) {
+        return -1;
+    }
+
+    /* Copy the data in the slot, growing it only if needed */
+    app_ring_slot* slot = &ring->slots[tail % APP_BUFFER_SLOTS];
+    if (bf.size > slot->capacity) {
+        slot->data = realloc(slot->data, bf.size);
+        slot->capacity = bf.size;
+    }
+    memcpy(slot->data, bf.data, bf.size);
+    slot->size = bf.size;
+
+    /* Publish the slot, then wake the consumer only if it is asleep */
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST)) {
+        syscall(SYS_futex, &ring->tail, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+
+    return 0;
 }
 
-void app_buffer_put(mic_tcp_payload bf)
+int app_ring_free(app_ring* ring)
 {
-    /* Prepare a buffer entry to store the data */
-    struct app_buffer_entry * entry = malloc(sizeof(struct app_buffer_entry));
-    entry->bf.size = bf.size;
-    entry->bf.data = malloc(bf.size);
-    memcpy(entry->bf.data, bf.data, bf.size);
+    return APP_BUFFER_SLOTS - (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+}
 
-    /* Lock a mutex to protect the buffer from corruption */
-    pthread_mutex_lock(&lock);
+int app_ring_count(app_ring* ring)
+{
+    return __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) - __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+}
+
+int app_buffer_get(mic_tcp_payload app_buff)
+{
+    return app_ring_get(default_ring, app_buff);
+}
+
+int app_buffer_put(mic_tcp_payload bf)
+{
+    return app_ring_put(default_ring, bf);
+}
 
-    /* Insert the packet in the buffer, at the end of it */
-    TAILQ_INSERT_TAIL(&app_buffer_head, entry, entries);
 
-    /* Release the mutex */
-    pthread_mutex_unlock(&lock);
 
-    /* We can now signal to any potential thread waiting that the buffer is
-       no longer empty */
-    pthread_cond_broadcast(&buffer_empty_cond);
+/* Hands one received datagram to the protocol */
+static void deliver(unsigned char* datagram, int size, const struct sockaddr_in* source, mic_tcp_ip_addr local)
+{
+    mic_tcp_pdu pdu;
+    char remote_buf[INET_ADDRSTRLEN];
+    mic_tcp_ip_addr remote;
+    int header_size = wire_decode(datagram, size, &(pdu.header));
+
+    if (header_size == -1) {
+        return;
+    }
+    /* The payload points into the datagram, right after the header */
+    pdu.payload.data = (char *) datagram + header_size;
+    pdu.payload.size = size - header_size;
+    inet_ntop(AF_INET, &(source->sin_addr), remote_buf, sizeof(remote_buf));
+    remote.addr = remote_buf;
+    remote.addr_size = strlen(remote.addr) + 1;
+    TRACE(TRACE_IP_RECV, pdu.header.seq_num, pdu.header.ack_num, pdu.payload.size);
+    LOG_DEBUG("[MICTCP-CORE] Réception d'un paquet IP de taille %d provenant de %s\n", size, remote.addr);
+    rx_source = *source;
+    rx_source_valid = 1;
+    process_received_PDU(pdu, local, remote);
+}
+
+/* Listening loop on the shard's ring: one io_uring_enter sends the ACKs of
+   the last batch and waits for the next datagrams */
+static void listen_ring(mic_tcp_ip_addr local)
+{
+    uring_datagram datagrams[RECV_BATCH_SIZE];
+    int nb_recv;
+    int i;
+
+    while (1) {
+        if (uring_wait(shard_ring, -1) == -1) {
+            /* This should never happen */
+            LOG_ERROR("Error in recv\n");
+            continue;
+        }
+        for (nb_recv = 0; nb_recv < RECV_BATCH_SIZE && uring_next(shard_ring, &datagrams[nb_recv]) != -1; nb_recv++);
+        if (nb_recv == 0) {
+            continue;
+        }
+
+        __atomic_add_fetch(&recv_batches, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&recv_datagrams, nb_recv, __ATOMIC_RELAXED);
+
+        IP_send_batch_begin();
+        for (i = 0; i < nb_recv; i++) {
+            deliver(datagrams[i].data, datagrams[i].size, &datagrams[i].source, local);
+        }
+        IP_flush();
+        for (i = 0; i < nb_recv; i++) {
+            uring_release(shard_ring, &datagrams[i]);
+        }
+    }
 }
 
+/* Listening loop on the shared-memory region: the clients of this host
+   write their datagrams straight into it, and their ACKs go back the same
+   way, without a batch to flush */
+void* listening_shm(void* arg)
+{
+    struct sockaddr_in source;
+    shm_datagram d;
+    int nb_recv;
+    mic_tcp_ip_addr local;
+
+    LOG_INFO("[MICTCP-CORE] Demarrage du thread de reception en memoire partagee...\n");
+
+    local.addr = "localhost";
+    local.addr_size = strlen(local.addr) + 1;
 
+    memset(&source, 0, sizeof(source));
+    source.sin_family = AF_INET;
+    source.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    while (1) {
+        for (nb_recv = 0; nb_recv < RECV_BATCH_SIZE && shm_next(&d) != -1; nb_recv++) {
+            source.sin_port = htons(d.port);
+            deliver(d.data, d.size, &source, local);
+            shm_release(&d);
+        }
+        if (nb_recv == 0) {
+            shm_wait(-1);
+            continue;
+        }
+        __atomic_add_fetch(&recv_batches, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&recv_datagrams, nb_recv, __ATOMIC_RELAXED);
+    }
+}
 
 void* listening(void* arg)
 {
-    mic_tcp_pdu pdu_tmp;
-    int recv_size;
-    mic_tcp_ip_addr remote;
+    shard* sh = arg;
+
+    /* Preallocated datagram buffers, filled by a single recvmmsg */
+    unsigned char* datagrams[RECV_BATCH_SIZE];
+    struct mmsghdr msgs[RECV_BATCH_SIZE];
+    struct iovec iovs[RECV_BATCH_SIZE];
+    struct sockaddr_in addrs[RECV_BATCH_SIZE];
+    int nb_recv;
+    int i;
     mic_tcp_ip_addr local;
 
-    pthread_mutex_init(&lock, NULL);
+    LOG_INFO("[MICTCP-CORE] Demarrage du thread de reception reseau (shard %d)...\n", sh->index);
 
-    printf("[MICTCP-CORE] Demarrage du thread de reception reseau...\n");
+    /* ACKs leave from the socket the connection arrived on */
+    tx_socket = sh->socket;
 
-    const int payload_size = 1500 - API_HD_Size;
-    pdu_tmp.payload.size = payload_size;
-    pdu_tmp.payload.data = malloc(payload_size);
+    /* Generate a stub address for the local side */
+    local.addr = "localhost";
+    local.addr_size = strlen(local.addr) + 1;
 
-    remote.addr=malloc(100);
-    remote.addr_size=100;
+    /* The ring belongs to this thread alone, it is created here */
+    if (io_backend == IO_URING && (shard_ring = uring_open(sh->socket, IP_DATAGRAM_MAX, 1)) == NULL) {
+        LOG_ERROR("[MICTCP-CORE] io_uring indisponible pour le shard %d, retour aux sockets\n", sh->index);
+    }
+    if (shard_ring != NULL) {
+        listen_ring(local);
+    }
 
+    for (i = 0; i < RECV_BATCH_SIZE; i++) {
+        datagrams[i] = malloc(IP_DATAGRAM_MAX);
+        iovs[i].iov_base = datagrams[i];
+        iovs[i].iov_len = IP_DATAGRAM_MAX;
+        memset(&(msgs[i].msg_hdr), 0, sizeof(struct msghdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+    }
 
     while(1)
     {
-        remote.addr_size=100;
-        pdu_tmp.payload.size = payload_size;
-        recv_size = IP_recv(&pdu_tmp, &local, &remote, 0);
+        for (i = 0; i < RECV_BATCH_SIZE; i++) {
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+
+        /* Block for the first datagram, then take whatever else is queued */
+        __atomic_add_fetch(&ip_syscalls, 1, __ATOMIC_RELAXED);
+        nb_recv = recvmmsg(sh->socket, msgs, RECV_BATCH_SIZE, MSG_WAITFORONE, NULL);
 
-        if(recv_size != -1)
+        if(nb_recv == -1)
         {
-            process_received_PDU(pdu_tmp, local, remote);
-        } else {
             /* This should never happen */
-            printf("Error in recv\n");
+            LOG_ERROR("Error in recv\n");
+            continue;
+        }
+
+        __atomic_add_fetch(&recv_batches, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&recv_datagrams, nb_recv, __ATOMIC_RELAXED);
+
+        /* The ACKs produced for the whole batch go out together */
+        IP_send_batch_begin();
+        for (i = 0; i < nb_recv; i++) {
+            deliver(datagrams[i], msgs[i].msg_len, &addrs[i], local);
         }
+        IP_flush();
     }
 }
 
+void get_recv_batch_stats(unsigned long* batches, unsigned long* datagrams)
+{
+    *batches = __atomic_load_n(&recv_batches, __ATOMIC_RELAXED);
+    *datagrams = __atomic_load_n(&recv_datagrams, __ATOMIC_RELAXED);
+}
+
+void get_send_stats(unsigned long* datagrams)
+{
+    *datagrams = __atomic_load_n(&sent_datagrams, __ATOMIC_RELAXED);
+}
+
+void get_syscall_stats(unsigned long* syscalls)
+{
+    *syscalls = __atomic_load_n(&ip_syscalls, __ATOMIC_RELAXED) + uring_syscalls() + shm_syscalls();
+}
+
+const char* get_io_backend(void)
+{
+#ifdef MICTCP_SIM
+    return "sim";
+#endif
+    if (shm_attached || shm_serving) {
+        return "shm";
+    }
+    return (io_backend == IO_URING) ? "uring" : "sockets";
+}
 
 void set_loss_rate(unsigned short rate)
 {
@@ -338,11 +1193,27 @@ unsigned long get_now_time_msec()
 
 unsigned long get_now_time_usec()
 {
+#ifdef MICTCP_SIM
+    return sim_clock;
+#endif
     struct timespec now_time;
     clock_gettime( CLOCK_REALTIME, &now_time);
     return ((unsigned long)((now_time.tv_nsec / 1000) + (now_time.tv_sec * 1000000)));
 }
 
+void wait_until_usec(unsigned long date)
+{
+#ifdef MICTCP_SIM
+    sim_run(date, 0);
+#else
+    unsigned long now = get_now_time_usec();
+    if (date > now) {
+        struct timespec remaining = { (date - now) / 1000000, ((date - now) % 1000000) * 1000 };
+        nanosleep(&remaining, NULL);
+    }
+#endif
+}
+
 int min_size(int s1, int s2)
 {
     if(s1 <= s2) return s1;
@@ -0,0 +1,392 @@
+#include <api/mictcp_emu.h>
+#include <api/mictcp_log.h>
+#include <api/mictcp_trace.h>
+#ifdef MICTCP_SIM
+#include <api/mictcp_core.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
+
+#define EMU_BUCKET_DEFAULT 3000
+#define EMU_QUEUE_DEFAULT 65536
+
+/* Datagram waiting for its release date */
+typedef struct emu_packet
+{
+    unsigned long release;  /* usec, CLOCK_MONOTONIC (virtual clock in simulation) */
+    unsigned long order;    /* keeps FIFO order among equal release dates */
+    int fd;
+    struct sockaddr_storage dest;
+    socklen_t dest_len;
+    int size;
+    unsigned char* data;
+} emu_packet;
+
+typedef struct emu_config
+{
+    unsigned long delay;    /* usec */
+    unsigned long jitter;   /* usec */
+    double rate;            /* bytes per usec, 0 = unlimited */
+    double bucket;          /* bytes */
+    double queue;           /* bytes */
+    double loss;            /* probabilities, 0..1 */
+    double ge_p;
+    double ge_r;
+    double ge_loss;
+    double reorder;
+    double dup;
+    unsigned long seed;
+} emu_config;
+
+static int active = 0;
+static emu_config cfg;
+
+/* Everything below is protected by lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup;
+#ifndef MICTCP_SIM
+static pthread_t thread;
+#endif
+static unsigned long long prng;
+static int bad_state = 0;
+static double tokens;
+static unsigned long last_refill;
+static unsigned long next_order = 0;
+static emu_packet* heap = NULL;
+static int heap_size = 0;
+static int heap_capacity = 0;
+
+static unsigned long emu_now(void)
+{
+#ifdef MICTCP_SIM
+    return get_now_time_usec();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+/* splitmix64: the emulator has its own generator so that a seed gives the
+   same impairments whatever else calls rand() */
+static double emu_random(void)
+{
+    unsigned long long z = (prng += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*************************
+ * Release heap (min on release date, then order)
+ *************************/
+static int heap_before(const emu_packet* a, const emu_packet* b)
+{
+    return a->release < b->release || (a->release == b->release && a->order < b->order);
+}
+
+static int heap_push(const emu_packet* p)
+{
+    int i;
+
+    if (heap_size == heap_capacity) {
+        int capacity = (heap_capacity == 0) ? 256 : heap_capacity * 2;
+        emu_packet* grown = realloc(heap, capacity * sizeof(emu_packet));
+        if (grown == NULL) {
+            return -1;
+        }
+        heap = grown;
+        heap_capacity = capacity;
+    }
+
+    for (i = heap_size++; i > 0 && heap_before(p, &heap[(i - 1) / 2]); i = (i - 1) / 2) {
+        heap[i] = heap[(i - 1) / 2];
+    }
+    heap[i] = *p;
+    return 0;
+}
+
+static void heap_pop(emu_packet* p)
+{
+    emu_packet last = heap[--heap_size];
+    int i = 0;
+
+    *p = heap[0];
+    while (2 * i + 1 < heap_size) {
+        int child = 2 * i + 1;
+        if (child + 1 < heap_size && heap_before(&heap[child + 1], &heap[child])) {
+            child++;
+        }
+        if (!heap_before(&heap[child], &last)) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+}
+
+/*************************
+ * Delivery thread
+ *************************/
+#ifndef MICTCP_SIM
+static void* emu_thread(void* arg)
+{
+    emu_packet p;
+
+    pthread_mutex_lock(&lock);
+    while (1) {
+        if (heap_size == 0) {
+            pthread_cond_wait(&wakeup, &lock);
+            continue;
+        }
+
+        unsigned long now = emu_now();
+        if (heap[0].release > now) {
+            struct timespec until;
+            until.tv_sec = heap[0].release / 1000000;
+            until.tv_nsec = (heap[0].release % 1000000) * 1000;
+            pthread_cond_timedwait(&wakeup, &lock, &until);
+            continue;
+        }
+
+        heap_pop(&p);
+        pthread_mutex_unlock(&lock);
+        sendto(p.fd, p.data, p.size, 0, (struct sockaddr *) &p.dest, p.dest_len);
+        free(p.data);
+        pthread_mutex_lock(&lock);
+    }
+    return NULL;
+}
+#endif
+
+/*************************
+ * Configuration
+ *************************/
+static int parse(const char* spec, emu_config* c)
+{
+    char* copy = strdup(spec);
+    char* save = NULL;
+    char* item;
+    int result = 0;
+
+    memset(c, 0, sizeof(emu_config));
+    c->bucket = EMU_BUCKET_DEFAULT;
+    c->queue = EMU_QUEUE_DEFAULT;
+    c->ge_loss = 1;
+    c->seed = 1;
+
+    for (item = strtok_r(copy, ",", &save); item != NULL && result == 0; item = strtok_r(NULL, ",", &save)) {
+        char* value = strchr(item, '=');
+        char* end;
+        double v;
+
+        if (value == NULL) {
+            result = -1;
+            break;
+        }
+        *value++ = '\0';
+        v = strtod(value, &end);
+        if (end == value || *end != '\0' || v < 0) {
+            result = -1;
+            break;
+        }
+
+        if (strcmp(item, "delay") == 0)          c->delay = v * 1000;
+        else if (strcmp(item, "jitter") == 0)    c->jitter = v * 1000;
+        else if (strcmp(item, "rate") == 0)      c->rate = v / 8000;
+        else if (strcmp(item, "bucket") == 0)    c->bucket = v;
+        else if (strcmp(item, "queue") == 0)     c->queue = v;
+        else if (strcmp(item, "loss") == 0)      c->loss = v / 100;
+        else if (strcmp(item, "ge_p") == 0)      c->ge_p = v / 100;
+        else if (strcmp(item, "ge_r") == 0)      c->ge_r = v / 100;
+        else if (strcmp(item, "ge_loss") == 0)   c->ge_loss = v / 100;
+        else if (strcmp(item, "reorder") == 0)   c->reorder = v / 100;
+        else if (strcmp(item, "dup") == 0)       c->dup = v / 100;
+        else if (strcmp(item, "seed") == 0)      c->seed = (unsigned long) v;
+        else result = -1;
+    }
+
+    free(copy);
+    return result;
+}
+
+int emu_init(void)
+{
+    const char* spec = getenv(EMU_ENV);
+#ifndef MICTCP_SIM
+    pthread_condattr_t attr;
+#endif
+
+#ifdef MICTCP_SIM
+    /* The simulated network is the emulator, impaired or not */
+    if (spec == NULL) {
+        spec = "";
+    }
+#endif
+    if (active || spec == NULL) {
+        return active;
+    }
+#ifndef MICTCP_SIM
+    if (spec[0] == '\0') {
+        return 0;
+    }
+#endif
+    if (parse(spec, &cfg) == -1) {
+        LOG_ERROR("[MICTCP-CORE] %s invalide : %s\n", EMU_ENV, spec);
+        return -1;
+    }
+
+    prng = cfg.seed;
+    tokens = cfg.bucket;
+    last_refill = emu_now();
+
+#ifndef MICTCP_SIM
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&thread, NULL, emu_thread, NULL) != 0) {
+        return -1;
+    }
+#endif
+
+    active = 1;
+    LOG_INFO("[MICTCP-CORE] Emulation reseau : %s\n", spec);
+    return 1;
+}
+
+int emu_active(void)
+{
+    return active;
+}
+
+/*************************
+ * Send path
+ *************************/
+
+/* Gilbert-Elliott: one state transition per datagram, then a loss draw
+   with the probability of the current state */
+static int lost(void)
+{
+    if (bad_state) {
+        if (emu_random() < cfg.ge_r) {
+            bad_state = 0;
+        }
+    } else if (emu_random() < cfg.ge_p) {
+        bad_state = 1;
+    }
+    return emu_random() < (bad_state ? cfg.ge_loss : cfg.loss);
+}
+
+/* Token bucket: returns the departure date of a datagram of size bytes,
+   or 0 if the backlog behind the bucket is full */
+static unsigned long departure(unsigned long now, int size)
+{
+    if (cfg.rate == 0) {
+        return now;
+    }
+
+    tokens += (now - last_refill) * cfg.rate;
+    if (tokens > cfg.bucket) {
+        tokens = cfg.bucket;
+    }
+    last_refill = now;
+
+    if (size - tokens > cfg.queue) {
+        return 0;
+    }
+    tokens -= size;
+    return (tokens >= 0) ? now : now + (unsigned long) (-tokens / cfg.rate);
+}
+
+int emu_send(int fd, const struct msghdr* msg)
+{
+    int size = 0;
+    int copies;
+    unsigned long now;
+    unsigned long depart;
+    size_t i;
+
+    for (i = 0; i < msg->msg_iovlen; i++) {
+        size += msg->msg_iov[i].iov_len;
+    }
+
+    pthread_mutex_lock(&lock);
+    now = emu_now();
+
+    if (lost() || (depart = departure(now, size)) == 0) {
+        pthread_mutex_unlock(&lock);
+        TRACE(TRACE_IP_LOSS, 0, 0, size);
+        return size;
+    }
+
+    copies = (emu_random() < cfg.dup) ? 2 : 1;
+    while (copies-- > 0) {
+        emu_packet p;
+        unsigned long release = depart;
+
+        if (emu_random() >= cfg.reorder) {
+            long offset = (cfg.jitter > 0) ? (long) ((2 * emu_random() - 1) * cfg.jitter) : 0;
+            release += cfg.delay;
+            release = (offset < 0 && (unsigned long) -offset > release - depart) ? depart : release + offset;
+        }
+
+#ifndef MICTCP_SIM
+        /* Nothing ahead of it and nothing to wait for: send it right away */
+        if (release <= now && heap_size == 0) {
+            sendmsg(fd, msg, 0);
+            continue;
+        }
+#endif
+
+        p.release = release;
+        p.order = next_order++;
+        p.fd = fd;
+        p.dest_len = msg->msg_namelen;
+        memcpy(&p.dest, msg->msg_name, msg->msg_namelen);
+        p.size = size;
+        p.data = malloc(size);
+        if (p.data == NULL) {
+            continue;
+        }
+        for (i = 0, size = 0; i < msg->msg_iovlen; i++) {
+            memcpy(p.data + size, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+            size += msg->msg_iov[i].iov_len;
+        }
+        if (heap_push(&p) == -1) {
+            free(p.data);
+            continue;
+        }
+        if (heap[0].order == p.order) {
+            pthread_cond_signal(&wakeup);
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+    return size;
+}
+
+#ifdef MICTCP_SIM
+int emu_next(unsigned long date, unsigned long* release, struct sockaddr_in* dest, unsigned char** data)
+{
+    emu_packet p;
+
+    pthread_mutex_lock(&lock);
+    if (heap_size == 0 || heap[0].release > date) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    heap_pop(&p);
+    pthread_mutex_unlock(&lock);
+
+    *release = p.release;
+    memcpy(dest, &p.dest, sizeof(*dest));
+    *data = p.data;
+    return p.size;
+}
+#endif
@@ -0,0 +1,390 @@
+#include <api/mictcp_shm.h>
+#include <api/mictcp_core.h>
+#include <api/mictcp_log.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#define SHM_MAGIC "MICSHMEM"
+#define SHM_VERSION 1
+#define SHM_DIR "/dev/shm"
+
+/* Slot states */
+#define SHM_FREE 0
+#define SHM_CLAIMING 1      /* a client is setting it up */
+#define SHM_CLAIMED 2
+
+typedef struct shm_entry
+{
+    int size;
+    unsigned char data[IP_DATAGRAM_MAX];
+} shm_entry;
+
+/* head and tail only ever grow, each on its own cache line */
+typedef struct shm_ring
+{
+    unsigned int head __attribute__((aligned(64)));  /* next entry to read, owned by the consumer */
+    unsigned int tail __attribute__((aligned(64)));  /* next entry to write, owned by the producer */
+    shm_entry entries[SHM_RING_ENTRIES];
+} shm_ring;
+
+typedef struct shm_slot
+{
+    int state;
+    int32_t pid;            /* client, its slot is freed once it is gone */
+    unsigned short port;    /* client's UDP port, the server answers to it */
+    int client_waiting;     /* the client sleeps on its socket, ring it */
+    shm_ring to_server;
+    shm_ring to_client;
+} shm_slot;
+
+/* Mapped layout of mictcp-shm-<port>.bin */
+typedef struct shm_region
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_size;     /* sizeof(shm_slot), checked by clients */
+    int32_t pid;            /* server */
+    int slots_used;         /* slots ever claimed, the server scans those */
+    unsigned int doorbell __attribute__((aligned(64)));  /* futex word, bumped to wake the server */
+    int server_waiting;     /* the listening thread sleeps on doorbell */
+    shm_slot slots[SHM_SLOTS];
+} shm_region;
+
+/* One process either serves a region or is attached to one slot */
+static shm_region* region = NULL;
+static shm_slot* own = NULL;
+static char path[256];
+static int next_slot = 0;   /* round robin between clients, listening thread only */
+static pthread_mutex_t reply_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t recv_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long futex_calls = 0;
+
+static int alive(int32_t pid)
+{
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+static void futex(unsigned int* word, int op, unsigned int val, const struct timespec* timeout)
+{
+    /* Shared futex: the word lives in a file mapping, not FUTEX_*_PRIVATE */
+    __atomic_add_fetch(&futex_calls, 1, __ATOMIC_RELAXED);
+    syscall(SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+/* Maps an existing region, NULL if it is not one */
+static shm_region* map_region(void)
+{
+    struct stat st;
+    void* map;
+    int fd = open(path, O_RDWR);
+
+    if (fd == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size != sizeof(shm_region)) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, sizeof(shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return (map == MAP_FAILED) ? NULL : map;
+}
+
+static void remove_file(void)
+{
+    unlink(path);
+}
+
+static void detach(void)
+{
+    __atomic_store_n(&own->state, SHM_FREE, __ATOMIC_RELEASE);
+}
+
+static int push(shm_ring* r, const unsigned char* header, int header_size, const char* payload, int payload_size)
+{
+    unsigned int tail = r->tail;
+    shm_entry* e;
+
+    if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == SHM_RING_ENTRIES
+        || header_size + payload_size > IP_DATAGRAM_MAX) {
+        return -1;
+    }
+    e = &r->entries[tail % SHM_RING_ENTRIES];
+    memcpy(e->data, header, header_size);
+    if (payload_size > 0) {
+        memcpy(e->data + header_size, payload, payload_size);
+    }
+    e->size = header_size + payload_size;
+
+    /* Publish the entry before looking whether the consumer sleeps */
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+/* Whether a client has written something, with the loads ordered after
+   the store of server_waiting */
+static int to_server_pending(void)
+{
+    int used = __atomic_load_n(&region->slots_used, __ATOMIC_SEQ_CST);
+    int i;
+
+    for (i = 0; i < used; i++) {
+        shm_ring* r = &region->slots[i].to_server;
+        if (__atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) != r->head) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int shm_serve(unsigned short port)
+{
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/mictcp-shm-%u.bin", SHM_DIR, port);
+
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1 && errno == EEXIST) {
+        /* Left behind by a server that died, unless it still runs */
+        shm_region* old = map_region();
+        int taken = (old != NULL && alive(old->pid));
+
+        if (old != NULL) {
+            munmap(old, sizeof(shm_region));
+        }
+        if (taken) {
+            LOG_ERROR("[MICTCP-CORE] %s est deja servi par un autre processus\n", path);
+            return -1;
+        }
+        unlink(path);
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd == -1 || ftruncate(fd, sizeof(shm_region)) == -1) {
+        LOG_ERROR("[MICTCP-CORE] Impossible de creer %s\n", path);
+        if (fd != -1) {
+            close(fd);
+            unlink(path);
+        }
+        return -1;
+    }
+    region = mmap(NULL, sizeof(shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        LOG_ERROR("[MICTCP-CORE] Impossible de projeter %s\n", path);
+        region = NULL;
+        unlink(path);
+        return -1;
+    }
+
+    region->version = SHM_VERSION;
+    region->slot_size = sizeof(shm_slot);
+    region->pid = getpid();
+    /* Clients check the magic last */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(region->magic, SHM_MAGIC, sizeof(region->magic));
+
+    atexit(remove_file);
+    LOG_INFO("[MICTCP-CORE] Memoire partagee servie dans %s\n", path);
+    return 0;
+}
+
+int shm_next(shm_datagram* d)
+{
+    int used = __atomic_load_n(&region->slots_used, __ATOMIC_ACQUIRE);
+    int n;
+
+    for (n = 0; n < used; n++) {
+        int i = (next_slot + n) % used;
+        shm_slot* s = &region->slots[i];
+        shm_ring* r = &s->to_server;
+        unsigned int head = r->head;
+
+        if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == head
+            || __atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != SHM_CLAIMED) {
+            continue;
+        }
+        shm_entry* e = &r->entries[head % SHM_RING_ENTRIES];
+        d->data = e->data;
+        d->size = e->size;
+        d->port = s->port;
+        d->slot = i;
+        next_slot = i + 1;
+        return d->size;
+    }
+    return -1;
+}
+
+void shm_release(const shm_datagram* d)
+{
+    shm_ring* r = &region->slots[d->slot].to_server;
+
+    /* Hand the entry back to the client */
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+void shm_wait(long timeout)
+{
+    unsigned int doorbell = __atomic_load_n(&region->doorbell, __ATOMIC_ACQUIRE);
+    struct timespec ts = { timeout / 1000000, (timeout % 1000000) * 1000 };
+
+    __atomic_store_n(&region->server_waiting, 1, __ATOMIC_SEQ_CST);
+    if (!to_server_pending()) {
+        futex(&region->doorbell, FUTEX_WAIT, doorbell, (timeout >= 0) ? &ts : NULL);
+    }
+    __atomic_store_n(&region->server_waiting, 0, __ATOMIC_RELAXED);
+}
+
+int shm_reply(unsigned short port, const unsigned char* header, int header_size,
+              const char* payload, int payload_size)
+{
+    int used = __atomic_load_n(&region->slots_used, __ATOMIC_ACQUIRE);
+    shm_slot* s = NULL;
+    int i;
+    int pushed;
+
+    for (i = 0; i < used && s == NULL; i++) {
+        if (region->slots[i].port == port
+            && __atomic_load_n(&region->slots[i].state, __ATOMIC_ACQUIRE) == SHM_CLAIMED) {
+            s = &region->slots[i];
+        }
+    }
+    if (s == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&reply_lock);
+    pushed = push(&s->to_client, header, header_size, payload, payload_size);
+    pthread_mutex_unlock(&reply_lock);
+
+    if (pushed == -1) {
+        LOG_DEBUG("[MICTCP-CORE] Anneau du client %u plein, perte du paquet\n", port);
+        return 0;
+    }
+    /* Only one reply rings a sleeping client */
+    return __atomic_exchange_n(&s->client_waiting, 0, __ATOMIC_SEQ_CST) ? 1 : 0;
+}
+
+int shm_attach(unsigned short port, unsigned short own_port)
+{
+    shm_slot* s = NULL;
+    int used;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/mictcp-shm-%u.bin", SHM_DIR, port);
+    if ((region = map_region()) == NULL) {
+        return -1;
+    }
+    if (memcmp(region->magic, SHM_MAGIC, sizeof(region->magic)) != 0
+        || region->version != SHM_VERSION || region->slot_size != sizeof(shm_slot)
+        || !alive(region->pid)) {
+        munmap(region, sizeof(shm_region));
+        region = NULL;
+        return -1;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    /* The slots of clients that died are free again */
+    for (i = 0; i < SHM_SLOTS; i++) {
+        int claimed = SHM_CLAIMED;
+        if (__atomic_load_n(&region->slots[i].state, __ATOMIC_ACQUIRE) == SHM_CLAIMED
+            && !alive(region->slots[i].pid)) {
+            __atomic_compare_exchange_n(&region->slots[i].state, &claimed, SHM_FREE, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        }
+    }
+    for (i = 0; i < SHM_SLOTS && s == NULL; i++) {
+        int free_state = SHM_FREE;
+        if (__atomic_compare_exchange_n(&region->slots[i].state, &free_state, SHM_CLAIMING, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            s = &region->slots[i];
+        }
+    }
+    if (s == NULL) {
+        LOG_ERROR("[MICTCP-CORE] Plus de place dans %s\n", path);
+        munmap(region, sizeof(shm_region));
+        region = NULL;
+        return -1;
+    }
+
+    /* What the server answered to the previous owner is not ours; what
+       it left to the server is drained as usual */
+    s->pid = getpid();
+    s->port = own_port;
+    s->to_client.head = __atomic_load_n(&s->to_client.tail, __ATOMIC_ACQUIRE);
+    s->client_waiting = 0;
+    __atomic_store_n(&s->state, SHM_CLAIMED, __ATOMIC_RELEASE);
+
+    used = __atomic_load_n(&region->slots_used, __ATOMIC_RELAXED);
+    while (used < i && !__atomic_compare_exchange_n(&region->slots_used, &used, i, 0,
+                                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    own = s;
+    atexit(detach);
+    return 0;
+}
+
+void shm_send(const unsigned char* header, int header_size, const char* payload, int payload_size)
+{
+    int pushed;
+
+    pthread_mutex_lock(&send_lock);
+    pushed = push(&own->to_server, header, header_size, payload, payload_size);
+    pthread_mutex_unlock(&send_lock);
+
+    if (pushed == -1) {
+        LOG_DEBUG("[MICTCP-CORE] Anneau vers le serveur plein, perte du paquet\n");
+        return;
+    }
+    /* Only wake the listening thread if it sleeps, and only once */
+    if (__atomic_exchange_n(&region->server_waiting, 0, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&region->doorbell, 1, __ATOMIC_SEQ_CST);
+        futex(&region->doorbell, FUTEX_WAKE, 1, NULL);
+    }
+}
+
+int shm_recv(unsigned char* datagram, int max)
+{
+    shm_ring* r = &own->to_client;
+    unsigned int head;
+    int size;
+
+    pthread_mutex_lock(&recv_lock);
+    head = r->head;
+    if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == head) {
+        /* Empty: ask for the doorbell, then look again in case the reply
+           came before the server could see the request */
+        __atomic_store_n(&own->client_waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == head) {
+            pthread_mutex_unlock(&recv_lock);
+            return -1;
+        }
+    }
+    shm_entry* e = &r->entries[head % SHM_RING_ENTRIES];
+    size = min_size(e->size, max);
+    memcpy(datagram, e->data, size);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&recv_lock);
+    return size;
+}
+
+int shm_pending(void)
+{
+    return __atomic_load_n(&own->to_client.tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&own->to_client.head, __ATOMIC_RELAXED);
+}
+
+unsigned long shm_syscalls(void)
+{
+    return __atomic_load_n(&futex_calls, __ATOMIC_RELAXED);
+}
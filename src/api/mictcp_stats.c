@@ -0,0 +1,92 @@
+#include <api/mictcp_stats.h>
+#include <api/mictcp_log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static stats_slot* slots = NULL;
+static char path[256];
+
+static void remove_file(void)
+{
+    unlink(path);
+}
+
+/* Maps the shared page, only if MICTCP_STATS asks for it */
+static void open_page(void)
+{
+    const char* env = getenv(STATS_ENV);
+    const char* dir = getenv(STATS_DIR_ENV);
+    size_t size = sizeof(stats_file_header) + STATS_SLOTS * sizeof(stats_slot);
+    stats_file_header* hd;
+    int fd;
+
+    if (env == NULL || atoi(env) == 0) {
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/mictcp-stats-%d.bin", (dir != NULL) ? dir : "/dev/shm", (int) getpid());
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, size) == -1) {
+        LOG_ERROR("[MICTCP-CORE] Impossible de creer %s\n", path);
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+    hd = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hd == MAP_FAILED) {
+        LOG_ERROR("[MICTCP-CORE] Impossible de projeter %s\n", path);
+        unlink(path);
+        return;
+    }
+
+    hd->version = STATS_VERSION;
+    hd->capacity = STATS_SLOTS;
+    hd->slot_size = sizeof(stats_slot);
+    hd->pid = getpid();
+    /* Readers check the magic last */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(hd->magic, STATS_MAGIC, sizeof(hd->magic));
+
+    slots = (stats_slot*) (hd + 1);
+    atexit(remove_file);
+    LOG_INFO("[MICTCP-CORE] Compteurs exportes dans %s\n", path);
+}
+
+mic_tcp_stats* stats_attach(int fd)
+{
+    pthread_once(&once, open_page);
+    if (slots == NULL || fd < 0 || fd >= STATS_SLOTS) {
+        return NULL;
+    }
+    /* A descriptor freed by mic_tcp_close starts over from zero */
+    memset(&slots[fd].stats, 0, sizeof(mic_tcp_stats));
+    __atomic_store_n(&slots[fd].local_port, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&slots[fd].remote_port, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&slots[fd].used, 1, __ATOMIC_RELEASE);
+    return &slots[fd].stats;
+}
+
+void stats_detach(int fd)
+{
+    if (slots == NULL || fd < 0 || fd >= STATS_SLOTS) {
+        return;
+    }
+    __atomic_store_n(&slots[fd].used, 0, __ATOMIC_RELEASE);
+}
+
+void stats_describe(int fd, unsigned short local_port, unsigned short remote_port)
+{
+    if (slots == NULL || fd < 0 || fd >= STATS_SLOTS) {
+        return;
+    }
+    __atomic_store_n(&slots[fd].local_port, local_port, __ATOMIC_RELAXED);
+    __atomic_store_n(&slots[fd].remote_port, remote_port, __ATOMIC_RELAXED);
+}
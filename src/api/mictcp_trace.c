@@ -0,0 +1,78 @@
+#define _GNU_SOURCE /* gettid */
+#include <api/mictcp_core.h>
+#include <api/mictcp_trace.h>
+
+#ifdef MICTCP_TRACE
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Per-thread ring, mapped on the first event recorded by the thread */
+typedef struct trace_ring
+{
+    trace_file_header* header;
+    trace_event* events;
+} trace_ring;
+
+static __thread trace_ring ring = { NULL, NULL };
+static __thread int ring_failed = 0;
+
+static int trace_open(void)
+{
+    char path[256];
+    const char* dir = getenv("MICTCP_TRACE_DIR");
+    size_t map_size = sizeof(trace_file_header) + TRACE_RING_SIZE * sizeof(trace_event);
+    pid_t tid = syscall(SYS_gettid);
+    int fd;
+    void* map;
+
+    snprintf(path, sizeof(path), "%s/mictcp-trace-%d-%d.bin", (dir != NULL) ? dir : ".", getpid(), tid);
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+        return -1;
+    }
+    if (ftruncate(fd, map_size) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    /* A shared file mapping: the kernel writes it back even if we crash */
+    map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    ring.header = map;
+    ring.events = (trace_event *) (ring.header + 1);
+    memcpy(ring.header->magic, TRACE_MAGIC, sizeof(ring.header->magic));
+    ring.header->version = TRACE_VERSION;
+    ring.header->capacity = TRACE_RING_SIZE;
+    ring.header->tid = tid;
+    ring.header->head = 0;
+
+    return 0;
+}
+
+void trace_record(uint32_t event, uint32_t seq, uint32_t ack, uint32_t size)
+{
+    if (ring.header == NULL) {
+        if (ring_failed || trace_open() == -1) {
+            ring_failed = 1;
+            return;
+        }
+    }
+
+    /* Single writer per ring: no lock, the oldest events are overwritten */
+    uint64_t head = ring.header->head;
+    trace_event* e = &ring.events[head & (TRACE_RING_SIZE - 1)];
+    e->timestamp = get_now_time_usec();
+    e->event = event;
+    e->seq = seq;
+    e->ack = ack;
+    e->size = size;
+    __atomic_store_n(&ring.header->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,404 @@
+#define _GNU_SOURCE /* struct mmsghdr */
+#include <api/mictcp_uring.h>
+#include <api/mictcp_log.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#define URING_ENTRIES 64    /* submission queue, at least one batch of sends and a re-arm */
+#define URING_BUFFERS 256   /* provided buffers, a power of two */
+#define URING_GROUP 0       /* buffer group id */
+#define URING_RECV 1        /* user_data of the multishot recvmsg */
+#define URING_SEND 2        /* user_data of a sendmsg */
+
+struct uring
+{
+    int ring_fd;
+    int fd;                         /* UDP socket */
+
+    /* Submission ring: entries up to sq_local_tail are written, the
+       kernel has consumed those before *sq_head */
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail;
+    struct io_uring_sqe* sqes;
+
+    /* Completion ring */
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* ring_map;
+    size_t ring_map_size;
+    size_t sqes_size;
+
+    /* Provided buffers: the kernel takes them from buf_ring, buffer i
+       lives at buffers + i * buffer_size */
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    unsigned char* buffers;
+    int buffer_size;
+    unsigned short buf_tail;
+    int held;                       /* buffers the kernel filled, not released yet */
+
+    struct msghdr recv_msg;         /* template of the multishot recvmsg */
+    int armed;
+    int failed;                     /* the receive stopped on an error, it is not posted again */
+    int sends_in_flight;
+
+    /* Received datagrams, in arrival order, not handed out yet */
+    unsigned short ready_buffer[URING_BUFFERS];
+    int ready_size[URING_BUFFERS];
+    unsigned ready_head;
+    unsigned ready_tail;
+};
+
+static unsigned long syscalls = 0;
+
+static int sys_setup(unsigned entries, struct io_uring_params* p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(uring* r, unsigned to_submit, unsigned min_complete, long timeout)
+{
+    struct io_uring_getevents_arg arg;
+    struct timespec ts;
+    unsigned flags = IORING_ENTER_GETEVENTS;
+
+    __atomic_add_fetch(&syscalls, 1, __ATOMIC_RELAXED);
+    if (min_complete == 0 || timeout < 0) {
+        return syscall(__NR_io_uring_enter, r->ring_fd, to_submit, min_complete, flags, NULL, 0);
+    }
+
+    ts.tv_sec = timeout / 1000000;
+    ts.tv_nsec = (timeout % 1000000) * 1000;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (unsigned long) &ts;
+    return syscall(__NR_io_uring_enter, r->ring_fd, to_submit, min_complete, flags | IORING_ENTER_EXT_ARG,
+                   &arg, sizeof(arg));
+}
+
+static unsigned unsubmitted(uring* r)
+{
+    return r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static void publish(uring* r)
+{
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+}
+
+static struct io_uring_sqe* next_sqe(uring* r)
+{
+    struct io_uring_sqe* sqe;
+    unsigned index;
+
+    /* Full: hand what is queued to the kernel first */
+    if (unsubmitted(r) == r->sq_entries) {
+        publish(r);
+        sys_enter(r, r->sq_entries, 0, 0);
+    }
+    index = r->sq_local_tail & r->sq_mask;
+    sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[index] = index;
+    r->sq_local_tail++;
+    return sqe;
+}
+
+static void arm(uring* r)
+{
+    struct io_uring_sqe* sqe = next_sqe(r);
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = r->fd;
+    sqe->addr = (unsigned long) &r->recv_msg;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_GROUP;
+    sqe->user_data = URING_RECV;
+    publish(r);
+    r->armed = 1;
+}
+
+static void give_buffer(uring* r, unsigned short id)
+{
+    struct io_uring_buf* buf = &r->buf_ring->bufs[r->buf_tail & (URING_BUFFERS - 1)];
+
+    buf->addr = (unsigned long) (r->buffers + (size_t) id * r->buffer_size);
+    buf->len = r->buffer_size;
+    buf->bid = id;
+    r->buf_tail++;
+    __atomic_store_n(&r->buf_ring->tail, r->buf_tail, __ATOMIC_RELEASE);
+}
+
+/* Moves the completions out of the completion ring */
+static void reap(uring* r)
+{
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe* cqe = &r->cqes[head & r->cq_mask];
+
+        if (cqe->user_data == URING_SEND) {
+            r->sends_in_flight--;
+            if (cqe->res < 0) {
+                LOG_DEBUG("[MICTCP-CORE] Echec d'un envoi io_uring : %s\n", strerror(-cqe->res));
+            }
+            continue;
+        }
+
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            r->armed = 0;
+        }
+        if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+            r->ready_buffer[r->ready_tail % URING_BUFFERS] = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            r->ready_size[r->ready_tail % URING_BUFFERS] = cqe->res;
+            r->ready_tail++;
+            r->held++;
+        } else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+            LOG_ERROR("[MICTCP-CORE] Echec de la reception io_uring : %s\n", strerror(-cqe->res));
+            r->failed = 1;
+        }
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+    /* Out of buffers, the receive stopped: it starts again once one is back */
+    if (!r->armed && !r->failed && r->held < URING_BUFFERS) {
+        arm(r);
+    }
+}
+
+int uring_probe(void)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    uring* r;
+
+    if (fd == -1) {
+        return 0;
+    }
+    r = uring_open(fd, 64, 0);
+    if (r != NULL) {
+        uring_close(r);
+    }
+    close(fd);
+    return r != NULL;
+}
+
+uring* uring_open(int fd, int datagram_max, int single_issuer)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    uring* r = calloc(1, sizeof(uring));
+    size_t sq_size;
+    size_t cq_size;
+    int i;
+
+    if (r == NULL) {
+        return NULL;
+    }
+    r->fd = fd;
+
+    /* Room in the completion ring for every buffer and a batch of sends */
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = URING_BUFFERS + URING_ENTRIES;
+    if (single_issuer) {
+        p.flags |= IORING_SETUP_SINGLE_ISSUER;
+    }
+    if ((r->ring_fd = sys_setup(URING_ENTRIES, &p)) == -1) {
+        free(r);
+        return NULL;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        close(r->ring_fd);
+        free(r);
+        return NULL;
+    }
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->ring_map_size = (sq_size > cq_size) ? sq_size : cq_size;
+    r->ring_map = mmap(NULL, r->ring_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       r->ring_fd, IORING_OFF_SQ_RING);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->ring_fd, IORING_OFF_SQES);
+    r->buf_ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+    r->buf_ring = mmap(NULL, r->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    r->buffer_size = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + datagram_max;
+    r->buffers = malloc((size_t) URING_BUFFERS * r->buffer_size);
+    if (r->ring_map == MAP_FAILED || r->sqes == MAP_FAILED || r->buf_ring == MAP_FAILED || r->buffers == NULL) {
+        uring_close(r);
+        return NULL;
+    }
+
+    r->sq_head = (unsigned*) ((char*) r->ring_map + p.sq_off.head);
+    r->sq_tail = (unsigned*) ((char*) r->ring_map + p.sq_off.tail);
+    r->sq_array = (unsigned*) ((char*) r->ring_map + p.sq_off.array);
+    r->sq_mask = *(unsigned*) ((char*) r->ring_map + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    r->sq_local_tail = *r->sq_tail;
+    r->cq_head = (unsigned*) ((char*) r->ring_map + p.cq_off.head);
+    r->cq_tail = (unsigned*) ((char*) r->ring_map + p.cq_off.tail);
+    r->cq_mask = *(unsigned*) ((char*) r->ring_map + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*) ((char*) r->ring_map + p.cq_off.cqes);
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) r->buf_ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_GROUP;
+    if (syscall(__NR_io_uring_register, r->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        uring_close(r);
+        return NULL;
+    }
+    for (i = 0; i < URING_BUFFERS; i++) {
+        give_buffer(r, i);
+    }
+
+    /* The kernel writes the source address right after its recvmsg_out */
+    r->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+    arm(r);
+
+    /* A kernel without multishot recvmsg fails the request at once */
+    if (sys_enter(r, 1, 0, 0) == -1) {
+        uring_close(r);
+        return NULL;
+    }
+    reap(r);
+    if (r->failed) {
+        uring_close(r);
+        return NULL;
+    }
+    return r;
+}
+
+void uring_close(uring* r)
+{
+    if (r->ring_map != NULL && r->ring_map != MAP_FAILED) {
+        munmap(r->ring_map, r->ring_map_size);
+    }
+    if (r->sqes != NULL && r->sqes != MAP_FAILED) {
+        munmap(r->sqes, r->sqes_size);
+    }
+    close(r->ring_fd);
+    if (r->buf_ring != NULL && r->buf_ring != MAP_FAILED) {
+        munmap(r->buf_ring, r->buf_ring_size);
+    }
+    free(r->buffers);
+    free(r);
+}
+
+int uring_fd(uring* r)
+{
+    return r->ring_fd;
+}
+
+int uring_next(uring* r, uring_datagram* d)
+{
+    struct io_uring_recvmsg_out* out;
+    unsigned char* buffer;
+    int size;
+
+    if (r->ready_head == r->ready_tail) {
+        reap(r);
+        if (r->ready_head == r->ready_tail) {
+            return -1;
+        }
+    }
+
+    d->buffer = r->ready_buffer[r->ready_head % URING_BUFFERS];
+    size = r->ready_size[r->ready_head % URING_BUFFERS];
+    r->ready_head++;
+
+    /* recvmsg_out, then the source address, then the datagram */
+    buffer = r->buffers + (size_t) d->buffer * r->buffer_size;
+    out = (struct io_uring_recvmsg_out*) buffer;
+    d->data = buffer + sizeof(*out) + r->recv_msg.msg_namelen;
+    d->size = size - (int) (sizeof(*out) + r->recv_msg.msg_namelen);
+    if (d->size > (int) out->payloadlen) {
+        d->size = out->payloadlen;
+    }
+    memset(&d->source, 0, sizeof(d->source));
+    memcpy(&d->source, buffer + sizeof(*out),
+           (out->namelen < sizeof(d->source)) ? out->namelen : sizeof(d->source));
+    return d->size;
+}
+
+void uring_release(uring* r, const uring_datagram* d)
+{
+    give_buffer(r, d->buffer);
+    r->held--;
+    if (!r->armed && !r->failed) {
+        arm(r);
+    }
+}
+
+int uring_wait(uring* r, long timeout)
+{
+    unsigned to_submit = unsubmitted(r);
+    int ready;
+
+    reap(r);
+    ready = (r->ready_head != r->ready_tail);
+    if (to_submit == 0 && (ready || timeout == 0)) {
+        return 0;
+    }
+
+    /* The sends complete too: wait for them and one more completion.
+       ETIME and EINTR only mean nothing came in */
+    if (sys_enter(r, to_submit, (ready || timeout == 0) ? 0 : r->sends_in_flight + 1, timeout) == -1
+        && errno != ETIME && errno != EINTR) {
+        return -1;
+    }
+    reap(r);
+    return 0;
+}
+
+int uring_queue_sends(uring* r, struct mmsghdr* msgs, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        struct io_uring_sqe* sqe = next_sqe(r);
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = r->fd;
+        sqe->addr = (unsigned long) &msgs[i].msg_hdr;
+        sqe->len = 1;
+        sqe->user_data = URING_SEND;
+        r->sends_in_flight++;
+    }
+    publish(r);
+    return n;
+}
+
+int uring_settle(uring* r)
+{
+    /* UDP sends complete inline: submitting is usually enough */
+    while (r->sends_in_flight > 0) {
+        unsigned to_submit = unsubmitted(r);
+
+        if (sys_enter(r, to_submit, (to_submit > 0) ? 0 : 1, -1) == -1 && errno != EINTR) {
+            return -1;
+        }
+        reap(r);
+    }
+    return 0;
+}
+
+unsigned long uring_syscalls(void)
+{
+    return __atomic_load_n(&syscalls, __ATOMIC_RELAXED);
+}
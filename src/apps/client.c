@@ -1,8 +1,10 @@
 #include <mictcp.h>
 #include <stdio.h>
 #include <string.h>
+#include <poll.h>
 
 #define MAX_SIZE 1000
+#define ENABLE_COALESCING 1 // les lignes lues d'un coup (copier-coller, tube) partent regroupées
 
 int main(int argc, char *argv[])
 {
@@ -34,6 +36,11 @@ int main(int argc, char *argv[])
         printf("[TSOCK] Connexion du socket MICTCP: OK\n");
     }
 
+    if (ENABLE_COALESCING && mic_tcp_set_coalescing(sockfd, 1) == -1)
+    {
+        printf("[TSOCK] Erreur a l'activation du regroupement!\n");
+    }
+
     memset(chaine, 0, MAX_SIZE);
 
     printf("[TSOCK] Entrez vos message a envoyer, CTRL+D pour quitter\n");
@@ -42,6 +49,12 @@ int main(int argc, char *argv[])
         int sent_size = mic_tcp_send(sockfd, chaine, strlen(chaine)+1);
         printf("[TSOCK] Appel de mic_send avec un message de taille : %lu\n", strlen(chaine)+1);
         printf("[TSOCK] Appel de mic_send valeur de retour : %d\n", sent_size);
+
+        // plus rien à lire pour l'instant : ne pas faire attendre les lignes regroupées
+        struct pollfd entree = { fileno(stdin), POLLIN, 0 };
+        if (ENABLE_COALESCING && poll(&entree, 1, 0) == 0) {
+            mic_tcp_flush(sockfd);
+        }
     }
 
     mic_tcp_close(sockfd);
@@ -16,6 +16,12 @@
 //
 
 #define ENABLE_TCP_LOSS 1
+#define ENABLE_DEADLINE 1           // les paquets rtp arrivés après leur date de lecture ne sont plus retransmis
+#define PLAYOUT_DELAY_USEC 200000   // retard de lecture accepté par le puits par rapport au timestamp rtp
+#define ENABLE_FEC 1                // parités Reed-Solomon : les pertes sont réparées sans attendre de retransmission
+#define FEC_K 8                     // paquets rtp par groupe
+#define FEC_M 2                     // parités par groupe
+#define SEND_BUFFER 64              // messages en attente d'émission : l'envoi ne bloque plus la lecture du fichier
 #define MAX_UDP_SEGMENT_SIZE 1480
 #define MICTCP_PORT 1337
 #define VIDEO_FILE "../video/video_wildlife.bin"
@@ -65,6 +71,7 @@ static void file_to_mictcp(char* filename);
 static void mictcp_to_udp(char *host, int port);
 static int read_rtp_packet(FILE *fd, struct timespec *timestamp, char *buffer, int buffer_size);
 static struct timespec tsSubtract(struct timespec time1, struct timespec time2);
+static long tsToUsec(struct timespec time);
 static void usage(void);
 
 //
@@ -221,18 +228,26 @@ static void file_to_mictcp(char* filename)
     dest_addr.ip_addr.addr = "localhost";
     dest_addr.ip_addr.addr_size = strlen(dest_addr.ip_addr.addr) + 1; // '\0'
     dest_addr.port = MICTCP_PORT;
+    if (ENABLE_FEC && mic_tcp_set_fec(sockfd, FEC_RS, FEC_K, FEC_M) == -1) {
+        printf("ERROR enabling FEC on the MICTCP socket\n");
+    }
     if (mic_tcp_connect(sockfd, dest_addr) == -1) {
         printf("ERROR connecting the MICTCP socket\n");
     }
+    if (mic_tcp_set_send_buffer(sockfd, SEND_BUFFER) == -1) {
+        printf("ERROR enabling the send buffer on the MICTCP socket\n");
+    }
 
     /* Ouverture du fichier vidéo */
     FILE *filefd = fopen(filename, "rb");
     ERROR_IF(filefd == NULL, "Error fopen");
 
     struct timespec current_time, last_time;    // stockage des timestamps
+    struct timespec first_time, start_time;     // premier timestamp rtp et date de son envoi
     char buffer[MAX_UDP_SEGMENT_SIZE];          // buffer de lecture/ecriture
     last_time.tv_sec = -1;
     last_time.tv_nsec = LONG_MAX;
+    first_time.tv_sec = -1;
 
     /* Lecture jusqu'à la fin du fichier vidéo */
     while (!feof(filefd)) {
@@ -248,7 +263,22 @@ static void file_to_mictcp(char* filename)
         last_time = current_time;
 
         /* Envoi du paquet rtp via mictcp */
-        int nb_sent = mic_tcp_send(sockfd, buffer, nb_read);
+        int nb_sent;
+        if (ENABLE_DEADLINE) {
+            /* Le puits lit le paquet à start_time + (timestamp - premier timestamp) + PLAYOUT_DELAY_USEC :
+               le temps restant jusque-là est la durée de vie du paquet */
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (first_time.tv_sec == -1) {
+                first_time = current_time;
+                start_time = now;
+            }
+            long ttl = tsToUsec(tsSubtract(current_time, first_time)) + PLAYOUT_DELAY_USEC
+                       - tsToUsec(tsSubtract(now, start_time));
+            nb_sent = mic_tcp_send_deadline(sockfd, buffer, nb_read, ttl);
+        } else {
+            nb_sent = mic_tcp_send(sockfd, buffer, nb_read);
+        }
         if (nb_sent < 0) {
             printf("ERROR on MICTCP send\n");
         }
@@ -297,14 +327,15 @@ static void mictcp_to_udp(char *host, int port)
 
     /* Acceptation d'une demande de connexion */
     mic_tcp_sock_addr mt_remote_addr;
-    if (mic_tcp_accept(mictcp_sockfd, &mt_remote_addr) == -1) {
+    int mictcp_connfd = mic_tcp_accept(mictcp_sockfd, &mt_remote_addr);
+    if (mictcp_connfd == -1) {
         printf("ERROR on accept on the MICTCP socket\n");
     }
 
     /* Lecture mictcp vers udp */
     char buff[MAX_UDP_SEGMENT_SIZE];    // buffer de lecture/ecriture
     while (1) {
-        int nb_read = mic_tcp_recv(mictcp_sockfd, buff, MAX_UDP_SEGMENT_SIZE);
+        int nb_read = mic_tcp_recv(mictcp_connfd, buff, MAX_UDP_SEGMENT_SIZE);
         if (nb_read <= 0) {
             if (nb_read < 0) {
                 printf("ERROR on mic_recv on the MICTCP socket\n");
@@ -317,6 +348,9 @@ static void mictcp_to_udp(char *host, int port)
     }
 
     /* Fermeture des sockets */
+    if (mic_tcp_close(mictcp_connfd) == -1) {
+        printf("ERROR on MICTCP close\n");
+    }
     if (mic_tcp_close(mictcp_sockfd) == -1) {
         printf("ERROR on MICTCP close\n");
     }
@@ -369,3 +403,11 @@ static struct timespec tsSubtract(struct timespec time1, struct timespec time2)
 
     return (result);
 }
+
+/**
+ * Convert a duration to microseconds
+ */
+static long tsToUsec(struct timespec time)
+{
+    return time.tv_sec * 1000000L + time.tv_nsec / 1000;
+}
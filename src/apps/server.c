@@ -6,6 +6,7 @@
 int main(int argc, char *argv[])
 {
     int sockfd;
+    int connfd;
     mic_tcp_sock_addr addr;
     mic_tcp_sock_addr remote_addr;
     char chaine[MAX_SIZE];
@@ -35,7 +36,7 @@ int main(int argc, char *argv[])
         printf("[TSOCK] Bind du socket MICTCP: OK\n");
     }
 
-    if (mic_tcp_accept(sockfd, &remote_addr) == -1)
+    if ((connfd = mic_tcp_accept(sockfd, &remote_addr)) == -1)
     {
         printf("[TSOCK] Erreur lors de l'accept sur le socket MICTCP!\n");
         return 1;
@@ -53,7 +54,7 @@ int main(int argc, char *argv[])
     while(1) {
         int rcv_size = 0;
         printf("[TSOCK] Attente d'une donnee, appel de mic_recv ...\n");
-        rcv_size = mic_tcp_recv(sockfd, chaine, MAX_SIZE);
+        rcv_size = mic_tcp_recv(connfd, chaine, MAX_SIZE);
         printf("[TSOCK] Reception d'un message de taille : %d\n", rcv_size);
         printf("[TSOCK] Message Recu : %s\n", chaine);
     }
@@ -0,0 +1,429 @@
+#include <mictcp.h>
+#include <api/mictcp_core.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/*
+ * Throughput and latency benchmark over the mictcp API.
+ * For every point of the sweep (message size x loss rate x duration x
+ * congestion control), forks one receiver process (server side) and one
+ * or more sender processes (client side), then prints one JSON object
+ * per point, all in a JSON array on stdout. Latency runs from the call
+ * to mic_tcp_send to the return of mic_tcp_recv.
+ *
+ * Usage: bench [-s sizes] [-l loss%] [-d seconds] [-c cc] [-n connections]
+ *              [-P senders] [-w window] [-b send buffer] [-r msg/s] [-p port]
+ * Lists are comma separated. MICTCP_EMU, MICTCP_SHARDS and MICTCP_IO apply
+ * as usual; with MICTCP_EMU set, the loss rates of the sweep are ignored.
+ * "io" is the IP backend the senders used: shm by default on this host,
+ * MICTCP_IO=sockets compares with UDP.
+ * System calls are those of the IP layer, senders and receiver together.
+ */
+
+#define BENCH_SAMPLES_MAX (1 << 20) /* latency reservoir */
+#define BENCH_LIST_MAX 16
+#define BENCH_DRAIN_USEC 200000 /* time left to the receiver after the senders exit */
+#define BENCH_READY_USEC 5000000
+
+typedef struct bench_config
+{
+    int size;
+    int loss;
+    double duration;
+    const char* cc;
+    int connections;
+    int senders;
+    int window;
+    int buffer; /* messages in the send buffer, 0 = synchronous send */
+    double rate; /* messages per second per sender, 0 = as fast as possible */
+    unsigned short port;
+} bench_config;
+
+/* Shared between the parent and its children, counters updated atomically */
+typedef struct bench_shared
+{
+    int ready;
+    int errors;
+    unsigned long start;            /* first mic_tcp_send, usec */
+    unsigned long end;              /* last sender done, usec */
+    unsigned long sent;
+    unsigned long datagrams;
+    unsigned long syscalls;         /* senders' */
+    unsigned long receiver_syscalls; /* kept current, the receiver is killed */
+    unsigned long retransmissions;
+    unsigned long delivered;
+    unsigned long delivered_bytes;
+    unsigned long last_recv;
+    unsigned long seen;
+    char io[16];                    /* IP backend the senders ran on */
+    unsigned long samples[BENCH_SAMPLES_MAX];
+} bench_shared;
+
+static void quiet(void)
+{
+    /* The protocol logs on stdout, which carries the JSON */
+    int null = open("/dev/null", O_WRONLY);
+    if (null != -1) {
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+}
+
+static mic_tcp_sock_addr bench_addr(unsigned short port)
+{
+    mic_tcp_sock_addr addr;
+    addr.ip_addr.addr = "127.0.0.1";
+    addr.ip_addr.addr_size = strlen(addr.ip_addr.addr) + 1;
+    addr.port = port;
+    return addr;
+}
+
+static void run_receiver(const bench_config* cfg, bench_shared* sh)
+{
+    int total = cfg->connections * cfg->senders;
+    int* fds = malloc(total * sizeof(int));
+    mic_tcp_pollfd* pfds = calloc(total, sizeof(mic_tcp_pollfd));
+    char* buffer = malloc(cfg->size);
+    unsigned int seed = 1;
+    mic_tcp_sock_addr remote;
+    int listener;
+    int i;
+
+    quiet();
+    if ((listener = mic_tcp_socket(SERVER)) == -1 || mic_tcp_bind(listener, bench_addr(cfg->port)) == -1) {
+        __atomic_add_fetch(&sh->errors, 1, __ATOMIC_RELAXED);
+        exit(1);
+    }
+    set_loss_rate(cfg->loss);
+    __atomic_store_n(&sh->ready, 1, __ATOMIC_RELEASE);
+
+    for (i = 0; i < total; i++) {
+        if ((fds[i] = mic_tcp_accept(listener, &remote)) == -1) {
+            __atomic_add_fetch(&sh->errors, 1, __ATOMIC_RELAXED);
+            exit(1);
+        }
+    }
+
+    /* A sender writes one message per connection per round, in connection
+       order: reading in accept order never waits on a message not yet sent.
+       Several senders each go at their own pace, and one that ran ahead
+       would wait on a full receive buffer: take whichever has data */
+    for (i = 0; i < total && cfg->senders > 1; i++) {
+        mic_tcp_set_nonblocking(fds[i], 1);
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+    }
+
+    while (1) {
+        if (cfg->senders > 1 && mic_tcp_poll(pfds, total, -1) == -1) {
+            __atomic_add_fetch(&sh->errors, 1, __ATOMIC_RELAXED);
+            exit(1);
+        }
+        for (i = 0; i < total; i++) {
+            uint64_t sent_at;
+            if (cfg->senders > 1 && !(pfds[i].revents & POLLIN)) {
+                continue;
+            }
+            int size = mic_tcp_recv(fds[i], buffer, cfg->size);
+            unsigned long now = get_now_time_usec();
+
+            if (size < (int) sizeof(sent_at)) {
+                continue;
+            }
+            memcpy(&sent_at, buffer, sizeof(sent_at));
+
+            /* Reservoir sampling keeps an unbiased subset of latencies */
+            if (sh->seen < BENCH_SAMPLES_MAX) {
+                sh->samples[sh->seen] = now - sent_at;
+            } else {
+                unsigned long j = ((unsigned long) rand_r(&seed) * RAND_MAX + rand_r(&seed)) % (sh->seen + 1);
+                if (j < BENCH_SAMPLES_MAX) {
+                    sh->samples[j] = now - sent_at;
+                }
+            }
+            unsigned long syscalls;
+            get_syscall_stats(&syscalls);
+            __atomic_store_n(&sh->receiver_syscalls, syscalls, __ATOMIC_RELAXED);
+            sh->seen++;
+            sh->delivered++;
+            sh->delivered_bytes += size;
+            sh->last_recv = now;
+        }
+    }
+}
+
+static void run_sender(const bench_config* cfg, bench_shared* sh)
+{
+    int* fds = malloc(cfg->connections * sizeof(int));
+    char* buffer = calloc(1, cfg->size);
+    unsigned long start;
+    unsigned long stop;
+    unsigned long sent = 0;
+    unsigned long datagrams = 0;
+    unsigned long syscalls = 0;
+    unsigned long retransmissions = 0;
+    unsigned long expected = 0;
+    int i;
+
+    quiet();
+    for (i = 0; i < cfg->connections; i++) {
+        if ((fds[i] = mic_tcp_socket(CLIENT)) == -1) {
+            __atomic_add_fetch(&sh->errors, 1, __ATOMIC_RELAXED);
+            exit(1);
+        }
+        set_loss_rate(cfg->loss);
+        if ((cfg->cc != NULL && mic_tcp_set_cc(fds[i], cfg->cc) == -1)
+            || (cfg->window > 0 && mic_tcp_set_send_window(fds[i], cfg->window) == -1)
+            || mic_tcp_connect(fds[i], bench_addr(cfg->port)) == -1
+            || (cfg->buffer > 0 && mic_tcp_set_send_buffer(fds[i], cfg->buffer) == -1)) {
+            __atomic_add_fetch(&sh->errors, 1, __ATOMIC_RELAXED);
+            exit(1);
+        }
+    }
+
+    /* Connected: a sender on this host now knows whether it uses shared memory */
+    strncpy(sh->io, get_io_backend(), sizeof(sh->io) - 1);
+
+    start = get_now_time_usec();
+    stop = start + (unsigned long) (cfg->duration * 1e6);
+    unsigned long first = 0;
+    __atomic_compare_exchange_n(&sh->start, &first, start, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+    while (1) {
+        unsigned long now = get_now_time_usec();
+        if (now >= stop) {
+            break;
+        }
+        if (cfg->rate > 0) {
+            unsigned long due = start + (unsigned long) (expected++ * 1e6 / cfg->rate);
+            if (due > now) {
+                usleep(due - now);
+            }
+        }
+        /* One message on every connection */
+        for (i = 0; i < cfg->connections; i++) {
+            uint64_t sent_at = get_now_time_usec();
+            memcpy(buffer, &sent_at, sizeof(sent_at));
+            if (mic_tcp_send(fds[i], buffer, cfg->size) == -1) {
+                __atomic_add_fetch(&sh->errors, 1, __ATOMIC_RELAXED);
+                exit(1);
+            }
+            sent++;
+        }
+    }
+
+    /* flush waits until everything in flight is acknowledged or abandoned;
+       the counters go with the socket at close */
+    for (i = 0; i < cfg->connections; i++) {
+        mic_tcp_stats stats;
+        mic_tcp_flush(fds[i]);
+        if (mic_tcp_get_stats(fds[i], &stats) == 0) {
+            retransmissions += stats.retransmissions;
+        }
+        mic_tcp_close(fds[i]);
+    }
+    get_send_stats(&datagrams);
+    get_syscall_stats(&syscalls);
+
+    __atomic_add_fetch(&sh->sent, sent, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sh->datagrams, datagrams, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sh->syscalls, syscalls, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sh->retransmissions, retransmissions, __ATOMIC_RELAXED);
+    stop = get_now_time_usec();
+    unsigned long end = __atomic_load_n(&sh->end, __ATOMIC_RELAXED);
+    while (end < stop && !__atomic_compare_exchange_n(&sh->end, &end, stop, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    exit(0);
+}
+
+static int compare_ulong(const void* a, const void* b)
+{
+    unsigned long x = *(const unsigned long*) a;
+    unsigned long y = *(const unsigned long*) b;
+    return (x > y) - (x < y);
+}
+
+static unsigned long percentile(const unsigned long* sorted, unsigned long n, double p)
+{
+    unsigned long rank;
+
+    if (n == 0) {
+        return 0;
+    }
+    rank = (unsigned long) (p * n + 0.999999);
+    return sorted[(rank == 0 ? 1 : rank) - 1];
+}
+
+static void print_string(const char* s)
+{
+    if (s == NULL) {
+        printf("null");
+    } else {
+        printf("\"%s\"", s);
+    }
+}
+
+/* Runs one point of the sweep and prints its JSON object */
+static int run_point(const bench_config* cfg, bench_shared* sh)
+{
+    pid_t receiver;
+    pid_t* senders = malloc(cfg->senders * sizeof(pid_t));
+    unsigned long waited = 0;
+    unsigned long n;
+    int i;
+
+    memset(sh, 0, offsetof(bench_shared, samples));
+    fflush(stdout);
+
+    if ((receiver = fork()) == 0) {
+        run_receiver(cfg, sh);
+    }
+    while (!__atomic_load_n(&sh->ready, __ATOMIC_ACQUIRE) && waited < BENCH_READY_USEC) {
+        usleep(1000);
+        waited += 1000;
+    }
+    usleep(50000); /* let the listening threads start */
+
+    for (i = 0; i < cfg->senders; i++) {
+        if ((senders[i] = fork()) == 0) {
+            run_sender(cfg, sh);
+        }
+    }
+    for (i = 0; i < cfg->senders; i++) {
+        waitpid(senders[i], NULL, 0);
+    }
+    usleep(BENCH_DRAIN_USEC);
+    kill(receiver, SIGKILL);
+    waitpid(receiver, NULL, 0);
+    free(senders);
+
+    n = (sh->seen < BENCH_SAMPLES_MAX) ? sh->seen : BENCH_SAMPLES_MAX;
+    qsort(sh->samples, n, sizeof(unsigned long), compare_ulong);
+
+    double elapsed = (sh->end > sh->start) ? (sh->end - sh->start) / 1e6 : 0;
+    double transfer = (sh->last_recv > sh->start) ? (sh->last_recv - sh->start) / 1e6 : 0;
+
+    printf("  {\"size\": %d, \"loss\": %d, \"duration_s\": %g, \"cc\": ", cfg->size, cfg->loss, cfg->duration);
+    print_string(cfg->cc);
+    printf(", \"window\": %d, \"buffer\": %d, \"connections\": %d, \"senders\": %d, \"rate\": %g, \"shards\": ",
+           cfg->window, cfg->buffer, cfg->connections * cfg->senders, cfg->senders, cfg->rate);
+    print_string(getenv("MICTCP_SHARDS"));
+    printf(", \"emu\": ");
+    print_string(getenv("MICTCP_EMU"));
+    printf(", \"io\": ");
+    print_string(sh->io);
+    printf(",\n   \"errors\": %d, \"sent\": %lu, \"delivered\": %lu, \"goodput_mbit_s\": %.3f, \"msg_per_s\": %.1f,"
+           " \"pdu_per_s\": %.1f, \"retransmissions\": %lu, \"syscalls\": %lu, \"syscalls_per_pdu\": %.3f,\n",
+           sh->errors, sh->sent, sh->delivered,
+           (transfer > 0) ? sh->delivered_bytes * 8 / transfer / 1e6 : 0,
+           (transfer > 0) ? sh->delivered / transfer : 0,
+           (elapsed > 0) ? sh->datagrams / elapsed : 0,
+           sh->retransmissions, sh->syscalls + sh->receiver_syscalls,
+           (sh->datagrams > 0) ? (double) (sh->syscalls + sh->receiver_syscalls) / sh->datagrams : 0);
+    printf("   \"latency_us\": {\"samples\": %lu, \"p50\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu}}",
+           sh->seen, percentile(sh->samples, n, 0.5), percentile(sh->samples, n, 0.99),
+           percentile(sh->samples, n, 0.999), (n > 0) ? sh->samples[n - 1] : 0);
+    return sh->errors;
+}
+
+static int parse_list(char* arg, char** items)
+{
+    int n = 0;
+    char* save = NULL;
+    char* item;
+
+    for (item = strtok_r(arg, ",", &save); item != NULL && n < BENCH_LIST_MAX; item = strtok_r(NULL, ",", &save)) {
+        items[n++] = item;
+    }
+    return n;
+}
+
+static void usage(const char* name, int status)
+{
+    fprintf((status == 0) ? stdout : stderr, "Usage: %s [-s sizes] [-l loss%%] [-d seconds] [-c cc] [-n connections]"
+            " [-P senders] [-w window] [-b send buffer] [-r msg/s] [-p port]\n", name);
+    exit(status);
+}
+
+int main(int argc, char* argv[])
+{
+    char default_sizes[] = "64,1400,65536";
+    char default_losses[] = "0";
+    char default_durations[] = "2";
+    char* sizes[BENCH_LIST_MAX];
+    char* losses[BENCH_LIST_MAX];
+    char* durations[BENCH_LIST_MAX];
+    char* ccs[BENCH_LIST_MAX] = { NULL };
+    int nb_sizes = 0, nb_losses = 0, nb_durations = 0, nb_ccs = 1;
+    bench_config cfg;
+    bench_shared* sh;
+    int first = 1;
+    int errors = 0;
+    int opt;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.connections = 1;
+    cfg.senders = 1;
+    cfg.port = 9000;
+
+    while ((opt = getopt(argc, argv, "s:l:d:c:n:P:w:b:r:p:h")) != -1) {
+        switch (opt) {
+        case 's': nb_sizes = parse_list(optarg, sizes); break;
+        case 'l': nb_losses = parse_list(optarg, losses); break;
+        case 'd': nb_durations = parse_list(optarg, durations); break;
+        case 'c': nb_ccs = parse_list(optarg, ccs); break;
+        case 'n': cfg.connections = atoi(optarg); break;
+        case 'P': cfg.senders = atoi(optarg); break;
+        case 'w': cfg.window = atoi(optarg); break;
+        case 'b': cfg.buffer = atoi(optarg); break;
+        case 'r': cfg.rate = atof(optarg); break;
+        case 'p': cfg.port = atoi(optarg); break;
+        case 'h': usage(argv[0], 0);
+        default: usage(argv[0], 1);
+        }
+    }
+    if (cfg.connections <= 0 || cfg.senders <= 0) {
+        usage(argv[0], 1);
+    }
+    if (nb_sizes == 0) nb_sizes = parse_list(default_sizes, sizes);
+    if (nb_losses == 0) nb_losses = parse_list(default_losses, losses);
+    if (nb_durations == 0) nb_durations = parse_list(default_durations, durations);
+
+    sh = mmap(NULL, sizeof(bench_shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sh == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    printf("[\n");
+    for (int s = 0; s < nb_sizes; s++) {
+        for (int l = 0; l < nb_losses; l++) {
+            for (int d = 0; d < nb_durations; d++) {
+                for (int c = 0; c < nb_ccs; c++) {
+                    cfg.size = atoi(sizes[s]);
+                    if (cfg.size < (int) sizeof(uint64_t)) {
+                        cfg.size = sizeof(uint64_t); /* room for the send timestamp */
+                    }
+                    cfg.loss = atoi(losses[l]);
+                    cfg.duration = atof(durations[d]);
+                    cfg.cc = ccs[c];
+                    if (!first) {
+                        printf(",\n");
+                    }
+                    first = 0;
+                    errors += run_point(&cfg, sh);
+                }
+            }
+        }
+    }
+    printf("\n]\n");
+    return errors != 0;
+}
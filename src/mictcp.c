@@ -1,312 +1,2198 @@
+#define _GNU_SOURCE /* ppoll */
 #include <mictcp.h>
 #include <api/mictcp_core.h>
+#include <api/mictcp_log.h>
+#include <api/mictcp_trace.h>
+#include <api/mictcp_stats.h>
 #include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 
 #define IP_ADDR_MAX_LEN 46
 
-#define MAX_SOCKET 5
-#define TIMEOUT 10
-#define TAILLE_FENETRE 10
+#define NB_SOCKETS_INITIAL 16   // taille initiale de la table de sockets, doublée à la demande
+#define NB_ALVEOLES_INITIAL 64  // taille initiale de la table de hachage, doublée à la demande
+#define PORT_EPHEMERE_MIN 49152 // ports attribués aux sockets connectés sans bind
+#define FILE_ACCEPT_MAX 128     // connexions en attente de mic_tcp_accept par socket en écoute
+#define DELAI_POIGNEE 5000000   // une poignée de main sans ACK est abandonnée après ce délai (usec)
+
+#define RTO_INITIAL 10000  // timeout avant la première mesure de RTT (usec)
+#define RTO_MIN 1000       // borne basse du RTO par défaut, granularité de IP_recv (usec)
+#define RTO_MAX 1000000    // borne haute du RTO après backoff (usec)
+#define ATTENTE_POIGNEE 1000 // pendant un mic_tcp_connect, les autres lecteurs des ACK repassent toutes les ms (usec)
+
+#define TAILLE_FENETRE_ENVOI 8      // nombre de PDU en vol par défaut
+#define SEUIL_REORDONNANCEMENT 3    // un PDU est perdu quand un PDU envoyé 3 places plus loin est acquitté
+#define MSS (IP_PAYLOAD_MAX - 2)    // données par PDU, moins le préfixe des symboles FEC
+#define CC_DEFAUT cc_reno           // contrôle de congestion des nouveaux sockets
+
+// compteurs de mic_tcp_get_stats, lisibles depuis un autre thread ou processus
+#define STAT_AJOUTER(sock, champ, n) __atomic_add_fetch(&(sock)->stats->champ, (n), __ATOMIC_RELAXED)
+#define STAT_FIXER(sock, champ, v) __atomic_store_n(&(sock)->stats->champ, (v), __ATOMIC_RELAXED)
 
 #define CLIENT_LOSS_RATE 0
 #define SERVER_LOSS_RATE 10
+#define SERVER_FEC_RATIO 50 // redondance maximale acceptée par le serveur (% de PDU de parité)
 
-mic_tcp_sock sockets[MAX_SOCKET] ; // table de sockets
-
+// table de sockets, indexée par le descripteur ; elle grandit à la demande
+// et les descripteurs libérés par mic_tcp_close sont réutilisés
+mic_tcp_sock** sockets = NULL;
 int nb_fd = 0;
+int capacite_sockets = 0;
+int* fds_libres = NULL;
+int nb_fds_libres = 0;
 
-int PE = 0;
-int PA = 0;
+// table de hachage (port local, port distant, adresse distante) -> socket
+mic_tcp_sock** table_hash = NULL;
+unsigned int nb_alveoles = 0;
+unsigned int nb_entrees_hash = 0;
 
-int fenetre[TAILLE_FENETRE] = {[0 ... TAILLE_FENETRE-1] = 1};
-int indice_fenetre = 0;  
-int perte_tolere = 0;
+// ports locaux déjà attribués
+unsigned char ports_utilises[65536 / 8];
+unsigned short prochain_port_ephemere = PORT_EPHEMERE_MIN;
+
+// protège les tables ci-dessus, lues par le thread de réception
+pthread_rwlock_t verrou_tables = PTHREAD_RWLOCK_INITIALIZER;
+
+// pris en lecture pendant le traitement d'un PDU reçu, qui garde le socket
+// trouvé dans la table de hachage ; un socket retiré de la table n'est
+// libéré qu'une fois ce verrou obtenu en écriture
+pthread_rwlock_t verrou_liberation = PTHREAD_RWLOCK_INITIALIZER;
+
+// charges utiles des SYN-ACK : l'envoi groupé du thread de réception les
+// lit au IP_flush suivant, qui a lieu au plus tard quand SEND_BATCH_SIZE PDU
+// attendent, et le socket peut avoir été libéré entre-temps
+static __thread mic_tcp_negociation negociations_envoyees[SEND_BATCH_SIZE + 1];
+static __thread unsigned int prochaine_negociation = 0;
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
 
+// eventfd qui réveille ce thread dans mic_tcp_poll
+static __thread int eventfd_attente = -1;
+
+// thread de protocole : émission, retransmissions et ACK des sockets à
+// tampon d'envoi, chaînés dans sockets_protocole
+static pthread_once_t protocole_lance = PTHREAD_ONCE_INIT;
+static pthread_t thread_protocole;
+static int eventfd_protocole = -1;
+static pthread_mutex_t verrou_protocole = PTHREAD_MUTEX_INITIALIZER;
+static mic_tcp_sock* sockets_protocole = NULL;
+
+// pris par mic_tcp_connect pendant la poignée de main : les autres lecteurs
+// du socket UDP client lui laissent le SYN-ACK
+static pthread_mutex_t verrou_poignee = PTHREAD_MUTEX_INITIALIZER;
+
 /*
- * Permet de créer un socket entre l’application et MIC-TCP
- * Retourne le descripteur du socket ou bien -1 en cas d'erreur
+ * Compare deux numéros de séquence sur 32 bits en tenant compte du rebouclage
+ * Retourne une valeur non nulle si a précède b
  */
-int mic_tcp_socket(start_mode sm)
+static int seq_inf(unsigned int a, unsigned int b)
 {
-    mic_tcp_sock sock;
-    
-    int result = -1;
-    printf("[MIC-TCP] Appel de la fonction: ");  printf(__FUNCTION__); printf("\n");
-    result = initialize_components(sm); /* Appel obligatoire */
-    set_loss_rate(10);
-    
-    if (result != -1){
-        sock.fd = nb_fd; // definir le numero de soc
-        sock.state = IDLE; 
-        nb_fd += 1;
-        sockets[sock.fd] = sock; // mettre le sock dans la table de sockets.
-        result = sock.fd;
-    } 
+    return (int)(a - b) < 0;
+}
 
-    return result;
+/*
+ * Met à jour SRTT/RTTVAR avec une nouvelle mesure et recalcule le RTO (RFC 6298)
+ */
+static void mesurer_rtt(mic_tcp_sock* sock, unsigned long mesure)
+{
+    mic_tcp_rtt_info* rtt = &sock->rtt;
+
+    if (rtt->srtt == 0){
+        // première mesure
+        rtt->srtt = mesure;
+        rtt->rttvar = mesure / 2;
+    } else {
+        unsigned long ecart = (rtt->srtt > mesure) ? rtt->srtt - mesure : mesure - rtt->srtt;
+        rtt->rttvar = (3 * rtt->rttvar + ecart) / 4;
+        rtt->srtt = (7 * rtt->srtt + mesure) / 8;
+    }
+
+    rtt->rto = rtt->srtt + ((4 * rtt->rttvar > sock->rto_min) ? 4 * rtt->rttvar : sock->rto_min);
+    if (rtt->rto < sock->rto_min){
+        rtt->rto = sock->rto_min;
+    } else if (rtt->rto > RTO_MAX){
+        rtt->rto = RTO_MAX;
+    }
+    STAT_FIXER(sock, srtt, rtt->srtt);
+    STAT_FIXER(sock, rto, rtt->rto);
 }
 
 /*
- * Permet d’attribuer une adresse à un socket.
- * Retourne 0 si succès, et -1 en cas d’échec
+ * Double le RTO après une expiration du timer (backoff exponentiel)
+ */
+static void doubler_rto(mic_tcp_sock* sock)
+{
+    sock->rtt.rto = (2 * sock->rtt.rto > RTO_MAX) ? RTO_MAX : 2 * sock->rtt.rto;
+    STAT_FIXER(sock, rto, sock->rtt.rto);
+}
+
+/*
+ * Convertit le RTO en timeout pour IP_recv (msec, arrondi au supérieur)
+ */
+static unsigned long rto_msec(mic_tcp_sock* sock)
+{
+    return (sock->rtt.rto + 999) / 1000;
+}
+
+/*
+ * Retourne le socket de descripteur fd, NULL s'il n'existe pas
+ */
+static mic_tcp_sock* get_socket(int fd)
+{
+    mic_tcp_sock* sock = NULL;
+
+    pthread_rwlock_rdlock(&verrou_tables);
+    if (fd >= 0 && fd < nb_fd){
+        sock = sockets[fd];
+    }
+    pthread_rwlock_unlock(&verrou_tables);
+    return sock;
+}
+
+/*
+ * Fonction de hachage sur le triplet (port local, port distant, adresse distante),
+ * l'adresse distante comprenant le port UDP du pair
+ */
+static unsigned int hacher(unsigned short port_local, unsigned short port_distant, const struct sockaddr_in* addr)
+{
+    unsigned int h = addr->sin_addr.s_addr * 2654435761u;
+    h ^= ((unsigned int) port_local << 16) | port_distant;
+    h ^= addr->sin_port;
+    h *= 2246822519u;
+    return h ^ (h >> 15);
+}
+
+/*
+ * Clé de démultiplexage d'un socket : un socket en écoute (sans pair) a un
+ * port distant et une adresse distante nuls
+ */
+static unsigned int hacher_socket(mic_tcp_sock* sock)
+{
+    return hacher(sock->local_addr.port, sock->remote_addr.port, &sock->remote_sockaddr);
+}
+
+/*
+ * Double la table de hachage (verrou_tables pris en écriture)
+ */
+static void agrandir_table_hash(void)
+{
+    unsigned int nouveau_nb = (nb_alveoles == 0) ? NB_ALVEOLES_INITIAL : 2 * nb_alveoles;
+    mic_tcp_sock** nouvelle_table = calloc(nouveau_nb, sizeof(mic_tcp_sock*));
+
+    for (unsigned int i = 0; i < nb_alveoles; i++){
+        mic_tcp_sock* sock = table_hash[i];
+        while (sock != NULL){
+            mic_tcp_sock* suivant = sock->suivant_hash;
+            unsigned int h = hacher_socket(sock) & (nouveau_nb - 1);
+            sock->suivant_hash = nouvelle_table[h];
+            nouvelle_table[h] = sock;
+            sock = suivant;
+        }
+    }
+    free(table_hash);
+    table_hash = nouvelle_table;
+    nb_alveoles = nouveau_nb;
+}
+
+/*
+ * Ajoute un socket à la table de démultiplexage (verrou_tables pris en écriture)
+ */
+static void inserer_hash(mic_tcp_sock* sock)
+{
+    if (nb_entrees_hash >= nb_alveoles){
+        agrandir_table_hash();
+    }
+    unsigned int h = hacher_socket(sock) & (nb_alveoles - 1);
+    sock->suivant_hash = table_hash[h];
+    table_hash[h] = sock;
+    nb_entrees_hash++;
+}
+
+/*
+ * Retire un socket de la table de démultiplexage (verrou_tables pris en écriture)
+ */
+static void retirer_hash(mic_tcp_sock* sock)
+{
+    if (nb_alveoles == 0){
+        return;
+    }
+    mic_tcp_sock** p = &table_hash[hacher_socket(sock) & (nb_alveoles - 1)];
+    while (*p != NULL){
+        if (*p == sock){
+            *p = sock->suivant_hash;
+            sock->suivant_hash = NULL;
+            nb_entrees_hash--;
+            return;
+        }
+        p = &(*p)->suivant_hash;
+    }
+}
+
+/*
+ * Cherche le socket destinataire d'un PDU : d'abord la connexion
+ * (port local, port distant, adresse distante), sinon un socket en écoute sur le port local
+ */
+static mic_tcp_sock* chercher_socket(unsigned short port_local, unsigned short port_distant, const struct sockaddr_in* addr_distante)
+{
+    struct sockaddr_in aucune;
+    mic_tcp_sock* sock = NULL;
+
+    memset(&aucune, 0, sizeof(aucune));
+
+    pthread_rwlock_rdlock(&verrou_tables);
+    if (nb_alveoles > 0){
+        for (int ecoute = 0; ecoute < 2 && sock == NULL; ecoute++){
+            unsigned short port = ecoute ? 0 : port_distant;
+            const struct sockaddr_in* a = ecoute ? &aucune : addr_distante;
+            mic_tcp_sock* s = table_hash[hacher(port_local, port, a) & (nb_alveoles - 1)];
+            for (; s != NULL; s = s->suivant_hash){
+                if (s->local_addr.port == port_local && s->remote_addr.port == port
+                    && s->remote_sockaddr.sin_addr.s_addr == a->sin_addr.s_addr
+                    && s->remote_sockaddr.sin_port == a->sin_port){
+                    sock = s;
+                    break;
+                }
+            }
+        }
+    }
+    pthread_rwlock_unlock(&verrou_tables);
+    return sock;
+}
+
+/*
+ * Réserve un port local libre (verrou_tables pris en écriture)
+ * Retourne 0 si succès, -1 si le port est déjà pris
+ */
+static int reserver_port(unsigned short port)
+{
+    if (ports_utilises[port / 8] & (1 << (port % 8))){
+        return -1;
+    }
+    ports_utilises[port / 8] |= (1 << (port % 8));
+    return 0;
+}
+
+/*
+ * Attribue un port éphémère libre (verrou_tables pris en écriture)
+ */
+static unsigned short port_ephemere(void)
+{
+    for (int essai = 0; essai < 65536 - PORT_EPHEMERE_MIN; essai++){
+        unsigned short port = prochain_port_ephemere;
+        prochain_port_ephemere = (port == 65535) ? PORT_EPHEMERE_MIN : port + 1;
+        if (reserver_port(port) == 0){
+            return port;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Enregistre le succès (1) ou l'échec (0) d'un envoi dans la fenêtre de pertes
+ */
+static void enregistrer_envoi(mic_tcp_sock* sock, int succes)
+{
+    sock->fenetre[sock->indice_fenetre] = succes;
+    sock->indice_fenetre = (sock->indice_fenetre + 1) % TAILLE_FENETRE;
+}
+
+/*
+ * Indique si la perte d'un PDU supplémentaire reste dans le taux de pertes toléré
+ */
+static int perte_acceptable(mic_tcp_sock* sock)
+{
+    int pertes = 1; // la perte en cours d'évaluation
+    for (int i = 0; i < TAILLE_FENETRE; i++){
+        if (i != sock->indice_fenetre && sock->fenetre[i] == 0){
+            pertes++;
+        }
+    }
+    return 100*pertes/TAILLE_FENETRE <= sock->perte_tolere;
+}
+
+/*
+ * Copie des données dans un buffer qui grandit à la demande
+ */
+static void copier_donnees(char** data, int* capacite, const char* src, int size)
+{
+    if (size > *capacite){
+        *data = realloc(*data, size);
+        *capacite = size;
+    }
+    memcpy(*data, src, size);
+}
+
+/*
+ * Construit et émet le PDU de données correspondant à un emplacement de la fenêtre
+ */
+static int emettre_pdu(mic_tcp_sock* sock, pdu_en_vol* slot)
+{
+    mic_tcp_pdu pdu;
+
+    pdu.header.source_port = sock->local_addr.port;
+    pdu.header.dest_port = sock->remote_addr.port;
+    pdu.header.seq_num = slot->seq;
+    pdu.header.ack_num = sock->base_envoi; // tout ce qui précède a été acquitté ou abandonné
+    pdu.header.ack = 0;
+    pdu.header.syn = 0;
+    pdu.header.fin = 0;
+    pdu.header.fec = 0;
+    pdu.header.segment = slot->segment;
+    pdu.header.taille_options = 0;
+    pdu.payload.data = slot->data;
+    pdu.payload.size = slot->size;
+
+    slot->date_envoi = get_now_time_usec();
+    slot->nb_envois++;
+    STAT_AJOUTER(sock, pdu_envoyes, 1);
+    STAT_AJOUTER(sock, octets_envoyes, slot->size);
+    if (slot->nb_envois > 1){
+        STAT_AJOUTER(sock, retransmissions, 1);
+    }
+    TRACE((slot->nb_envois == 1) ? TRACE_PDU_SEND : TRACE_PDU_RETRANSMIT, slot->seq, sock->base_envoi, slot->size);
+    return IP_send_resolved(pdu, &sock->remote_sockaddr);
+}
+
+/*
+ * Émet les PDU de parité du groupe de k PDU commençant à base, dont les
+ * données sont encore dans la fenêtre d'envoi (acquittées ou non)
+ */
+static void emettre_parites(mic_tcp_sock* sock, unsigned int base)
+{
+    char* data[FEC_K_MAX];
+    int tailles[FEC_K_MAX];
+    unsigned char segments[FEC_K_MAX];
+    mic_tcp_pdu pdu;
+
+    for (int i = 0; i < sock->fec.k; i++){
+        pdu_en_vol* slot = &sock->fenetre_envoi[(base + i) % TAILLE_FENETRE_ENVOI_MAX];
+        data[i] = slot->data;
+        tailles[i] = slot->size;
+        segments[i] = slot->segment;
+    }
+    mic_tcp_fec_encoder(&sock->fec, data, tailles, segments);
+
+    pdu.header.source_port = sock->local_addr.port;
+    pdu.header.dest_port = sock->remote_addr.port;
+    pdu.header.seq_num = base;
+    pdu.header.ack_num = sock->base_envoi;
+    pdu.header.ack = 0;
+    pdu.header.syn = 0;
+    pdu.header.fin = 0;
+    pdu.header.segment = 0;
+    pdu.header.taille_options = 0;
+    pdu.payload.size = sock->fec.taille_parite;
+
+    // les parités du groupe partent ensemble au IP_flush()
+    IP_send_batch_begin();
+    for (int j = 0; j < sock->fec.m; j++){
+        pdu.header.fec = j + 1;
+        pdu.payload.data = (char*) sock->fec.parite[j];
+        TRACE(TRACE_FEC_PARITY, base, j, pdu.payload.size);
+        STAT_AJOUTER(sock, parites_envoyees, 1);
+        IP_send_resolved(pdu, &sock->remote_sockaddr);
+    }
+    if (IP_flush() == -1){
+        LOG_ERROR("erreur envoi parités\n");
+    }
+}
+
+/*
+ * Fait avancer la base de la fenêtre d'envoi après les PDU acquittés ou abandonnés
+ */
+static void avancer_base_envoi(mic_tcp_sock* sock)
+{
+    while (sock->base_envoi != sock->PE){
+        pdu_en_vol* slot = &sock->fenetre_envoi[sock->base_envoi % TAILLE_FENETRE_ENVOI_MAX];
+        if (slot->etat == EN_VOL){
+            break;
+        }
+        slot->etat = LIBRE;
+        sock->base_envoi++;
+    }
+}
+
+/*
+ * Réveille les threads qui attendent ce socket dans mic_tcp_poll ;
+ * un thread déjà réveillé n'est pas signalé à nouveau
+ */
+static void reveiller(mic_tcp_sock* sock)
+{
+    uint64_t un = 1;
+
+    // ordonne le changement d'état qui précède avec la lecture de la liste
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sock->attentes, __ATOMIC_RELAXED) == NULL){
+        return;
+    }
+    pthread_mutex_lock(&sock->verrou_attentes);
+    for (mic_tcp_attente* a = sock->attentes; a != NULL; a = a->suivant){
+        if (!__atomic_exchange_n(a->signale, 1, __ATOMIC_SEQ_CST) && write(a->eventfd, &un, sizeof(un)) == -1){
+            LOG_ERROR("erreur reveil mic_tcp_poll\n");
+        }
+    }
+    pthread_mutex_unlock(&sock->verrou_attentes);
+}
+
+/*
+ * Réveille le thread de protocole, sauf depuis le thread de protocole lui-même
+ */
+static void reveiller_protocole(void)
+{
+    uint64_t un = 1;
+
+    if (!pthread_equal(pthread_self(), thread_protocole) && write(eventfd_protocole, &un, sizeof(un)) == -1){
+        LOG_ERROR("erreur reveil thread de protocole\n");
+    }
+}
+
+/*
+ * Traite un ACK : seq_num porte l'acquittement cumulatif (prochain numéro attendu
+ * par le récepteur), ack_num l'acquittement sélectif du PDU qui l'a déclenché
+ */
+static void traiter_ack(mic_tcp_sock* sock, mic_tcp_pdu ack)
+{
+    unsigned long now = get_now_time_usec();
+    unsigned int nb_acquittes = 0;
+
+    TRACE(TRACE_ACK_RECV, ack.header.seq_num, ack.header.ack_num, 0);
+    STAT_AJOUTER(sock, acks_recus, 1);
+
+    for (unsigned int seq = sock->base_envoi; seq != sock->PE; seq++){
+        pdu_en_vol* slot = &sock->fenetre_envoi[seq % TAILLE_FENETRE_ENVOI_MAX];
+        if (slot->etat == EN_VOL && (seq_inf(seq, ack.header.seq_num) || seq == ack.header.ack_num)){
+            // règle de Karn : pas de mesure sur un PDU retransmis
+            if (seq == ack.header.ack_num && slot->nb_envois == 1){
+                mesurer_rtt(sock, now - slot->date_envoi);
+            }
+            slot->etat = ACQUITTE;
+            enregistrer_envoi(sock, 1); // success
+            nb_acquittes++;
+        }
+    }
+    if (seq_inf(sock->plus_haut_acquitte, ack.header.ack_num) && seq_inf(ack.header.ack_num, sock->PE)){
+        sock->plus_haut_acquitte = ack.header.ack_num;
+    }
+    sock->fenetre_recepteur = ack.header.rwnd;
+    avancer_base_envoi(sock);
+    mic_tcp_cc_ack(&sock->cc, nb_acquittes, sock->base_envoi, sock->rtt.srtt, now);
+    reveiller(sock); // de la place a pu se libérer dans la fenêtre
+
+    if (sock->tampon_envoi != NULL){
+        // mic_tcp_flush attend peut-être ce dernier ACK
+        pthread_cond_broadcast(&sock->cond_envoi);
+        if (sock->tete_tampon != sock->queue_tampon || sock->nb_groupe > 0){
+            reveiller_protocole(); // l'ACK a été lu par un autre thread
+        }
+    }
+}
+
+/*
+ * Un PDU encore en vol est considéré perdu quand un PDU émis suffisamment
+ * après lui a été acquitté (seulement pour sa première émission)
+ */
+static int perte_detectee(mic_tcp_sock* sock, pdu_en_vol* slot)
+{
+    return slot->nb_envois == 1 && (int)(sock->plus_haut_acquitte - slot->seq) >= SEUIL_REORDONNANCEMENT;
+}
+
+/*
+ * Retransmet les PDU perdus (timer expiré ou perte détectée par les
+ * acquittements sélectifs), sauf si leur perte est tolérée ; un PDU dont
+ * l'échéance est passée est abandonné, perdu ou non
+ */
+static void traiter_expirations(mic_tcp_sock* sock)
+{
+    unsigned long now = get_now_time_usec();
+    unsigned long rto = sock->rtt.rto;
+    int retransmission = 0;
+    unsigned long dernier_expire = 0; // envoi le plus récent parmi les PDU expirés
+    int expire = 0;
+
+    // les PDU retransmis partent ensemble au IP_flush()
+    IP_send_batch_begin();
+    for (unsigned int seq = sock->base_envoi; seq != sock->PE; seq++){
+        pdu_en_vol* slot = &sock->fenetre_envoi[seq % TAILLE_FENETRE_ENVOI_MAX];
+        if (slot->etat != EN_VOL){
+            continue;
+        }
+        int expiration = (now - slot->date_envoi >= rto);
+        int perdu = perte_detectee(sock, slot);
+        int perime = (slot->echeance != 0 && now >= slot->echeance);
+        if (!expiration && !perdu && !perime){
+            continue;
+        }
+
+        // le contrôle de congestion réagit à la perte, tolérée ou non ;
+        // une expiration ne réduit la fenêtre qu'une fois pour toute la passe
+        if (perdu){
+            mic_tcp_cc_perte(&sock->cc, seq, sock->PE, now);
+        } else if (expiration){
+            expire = 1;
+            if (slot->date_envoi > dernier_expire){
+                dernier_expire = slot->date_envoi;
+            }
+        }
+
+        if (perime){
+            // arrivé après son échéance, le message ne servirait plus à rien :
+            // le récepteur le sautera en voyant avancer la base de la fenêtre
+            slot->etat = ABANDONNE;
+            TRACE(TRACE_PDU_ABANDON, seq, sock->base_envoi, slot->size);
+            STAT_AJOUTER(sock, echeances_depassees, 1);
+        } else if (slot->echeance != 0){
+            // avant l'échéance, la politique de pertes tolérées ne s'applique pas
+            if (emettre_pdu(sock, slot) == -1){
+                LOG_ERROR("error envoyer pdu\n");
+            }
+            retransmission |= expiration;
+        } else if (perte_acceptable(sock)){
+            // perte tolérée, le PDU ne sera plus retransmis
+            enregistrer_envoi(sock, 0);
+            slot->etat = ABANDONNE;
+            TRACE(TRACE_PDU_ABANDON, seq, sock->base_envoi, slot->size);
+            STAT_AJOUTER(sock, pertes_tolerees, 1);
+        } else { // perte non tolere, renvoie pdu
+            if (emettre_pdu(sock, slot) == -1){
+                LOG_ERROR("error envoyer pdu\n");
+            }
+            retransmission |= expiration;
+        }
+    }
+    IP_flush();
+
+    if (expire){
+        mic_tcp_cc_expiration(&sock->cc, dernier_expire, sock->PE, now);
+    }
+    if (retransmission){
+        doubler_rto(sock);
+    }
+    avancer_base_envoi(sock);
+}
+
+/*
+ * Retourne le délai (msec) avant la prochaine expiration de timer ou
+ * d'échéance dans la fenêtre d'envoi, 0 si l'une d'elles est déjà passée,
+ * -1 si aucun PDU n'est en vol
+ */
+static long prochaine_expiration(mic_tcp_sock* sock)
+{
+    unsigned long now = get_now_time_usec();
+    long delai = -1;
+
+    for (unsigned int seq = sock->base_envoi; seq != sock->PE; seq++){
+        pdu_en_vol* slot = &sock->fenetre_envoi[seq % TAILLE_FENETRE_ENVOI_MAX];
+        if (slot->etat != EN_VOL){
+            continue;
+        }
+        if (now - slot->date_envoi >= sock->rtt.rto || perte_detectee(sock, slot)
+            || (slot->echeance != 0 && now >= slot->echeance)){
+            return 0;
+        }
+        unsigned long date = slot->date_envoi + sock->rtt.rto;
+        if (slot->echeance != 0 && slot->echeance < date){
+            date = slot->echeance;
+        }
+        long reste = (long)((date - now + 999) / 1000);
+        if (delai == -1 || reste < delai){
+            delai = reste;
+        }
+    }
+    return delai;
+}
+
+/*
+ * Traite un datagramme reçu par ce thread si c'est un ACK de données, qui
+ * peut concerner n'importe quelle connexion de ce processus
+ */
+static void aiguiller_ack(mic_tcp_pdu ack)
+{
+    if ((ack.header.ack == 1) && (ack.header.syn == 0)){
+        struct sockaddr_in source;
+        mic_tcp_sock* cible = NULL;
+        pthread_rwlock_rdlock(&verrou_liberation);
+        if (IP_source(&source) == 0){
+            cible = chercher_socket(ack.header.dest_port, ack.header.source_port, &source);
+        }
+        if (cible != NULL){
+            pthread_mutex_lock(&cible->verrou_envoi);
+            traiter_ack(cible, ack);
+            pthread_mutex_unlock(&cible->verrou_envoi);
+        }
+        pthread_rwlock_unlock(&verrou_liberation);
+    }
+}
+
+/*
+ * Attend un datagramme au plus timeout msec (IP_RECV_NOWAIT : sans attendre)
+ * et le traite si c'est un ACK de données
+ * Retourne -1 si aucun datagramme n'est arrivé
+ */
+static int recevoir_ack(unsigned long timeout)
+{
+    mic_tcp_pdu ack;
+    mic_tcp_ip_addr local_addr_ip;
+    mic_tcp_ip_addr remote_addr_ip;
+    char local_buf[IP_ADDR_MAX_LEN];
+    char remote_buf[IP_ADDR_MAX_LEN];
+
+    local_addr_ip.addr = local_buf;
+    local_addr_ip.addr_size = IP_ADDR_MAX_LEN;
+    remote_addr_ip.addr = remote_buf;
+    remote_addr_ip.addr_size = IP_ADDR_MAX_LEN;
+    ack.payload.size = 0;
+    ack.payload.data = NULL;
+
+    int ret = IP_recv(&ack, &local_addr_ip, &remote_addr_ip, timeout);
+    if (ret != -1){
+        aiguiller_ack(ack);
+    }
+    return ret;
+}
+
+/*
+ * Côté client, traite les ACK déjà arrivés, sans attendre, sauf pendant la
+ * poignée de main d'un mic_tcp_connect
+ * Retourne 0 si le socket UDP a été vidé, -1 sinon
+ */
+static int recuperer_acks(void)
+{
+    if (IP_recv_fd() == -1 || pthread_mutex_trylock(&verrou_poignee) != 0){
+        return -1;
+    }
+    while (recevoir_ack(IP_RECV_NOWAIT) != -1);
+    pthread_mutex_unlock(&verrou_poignee);
+    return 0;
+}
+
+/*
+ * Récupère les ACK et gère les retransmissions tant que la fenêtre compte
+ * plus de max_en_vol PDU non acquittés ou qu'un timer a expiré
+ * Appelée sous le verrou d'émission, relâché pendant l'attente d'un ACK
+ */
+static void attendre_fenetre(mic_tcp_sock* sock, unsigned int max_en_vol)
+{
+    long delai;
+
+    while ((sock->PE - sock->base_envoi > max_en_vol) || (prochaine_expiration(sock) == 0)){
+        // attendre un ACK au plus jusqu'à la prochaine expiration de timer
+        delai = prochaine_expiration(sock);
+        pthread_mutex_unlock(&sock->verrou_envoi);
+        recevoir_ack((delai > 0) ? delai : 1);
+        pthread_mutex_lock(&sock->verrou_envoi);
+        traiter_expirations(sock);
+    }
+}
+
+/*
+ * Nombre de PDU que la fenêtre d'envoi peut contenir, bornée par la fenêtre
+ * de congestion et par celle du récepteur (un PDU reste permis pour sonder
+ * une fenêtre nulle)
+ */
+static unsigned int fenetre_effective(mic_tcp_sock* sock)
+{
+    unsigned int fenetre = mic_tcp_cc_fenetre(&sock->cc);
+    if (fenetre > (unsigned int) sock->taille_fenetre_envoi){
+        fenetre = sock->taille_fenetre_envoi;
+    }
+    if (fenetre > sock->fenetre_recepteur){
+        fenetre = (sock->fenetre_recepteur > 0) ? sock->fenetre_recepteur : 1;
+    }
+    return fenetre;
+}
+
+/*
+ * Sans attendre : retransmet ce qui doit l'être, puis retourne le nombre
+ * de places libres dans la fenêtre (les ACK arrivés sont traités avant,
+ * par recuperer_acks, hors du verrou d'émission)
+ */
+static unsigned int places_libres(mic_tcp_sock* sock)
+{
+    if (prochaine_expiration(sock) == 0){
+        traiter_expirations(sock);
+    }
+    unsigned int fenetre = fenetre_effective(sock);
+    unsigned int en_vol = sock->PE - sock->base_envoi;
+    return (en_vol < fenetre) ? fenetre - en_vol : 0;
+}
+
+/*
+ * Mode non bloquant : vrai si un message de mesg_size octets peut partir
+ * sans attendre de place dans la fenêtre ; un message de plus de segments
+ * que la fenêtre n'en contient attend seulement qu'elle soit vide
+ */
+static int pret_a_envoyer(mic_tcp_sock* sock, int mesg_size)
+{
+    unsigned int libres = places_libres(sock);
+    unsigned int segments = (mesg_size > MSS) ? (mesg_size + MSS - 1) / MSS : 1;
+
+    if (sock->regroupement && mesg_size + 2 <= MSS){
+        // un petit message rejoint le groupe, qui ne part que s'il déborde
+        if (sock->taille_groupe + 2 + mesg_size <= MSS){
+            return 1;
+        }
+    } else if (sock->regroupement && sock->nb_groupe > 0){
+        segments++; // le groupe en attente part avant le message
+    }
+    if (segments > fenetre_effective(sock)){
+        segments = fenetre_effective(sock);
+    }
+    return libres >= segments;
+}
+
+/*
+ * Livre un à un les messages regroupés dans un PDU SEG_GROUPE ; si le
+ * buffer applicatif se remplit, ceux déjà livrés seront sautés au prochain essai
+ * Retourne -1 si le buffer applicatif est plein, 0 sinon
+ */
+static int livrer_groupe(mic_tcp_sock* sock, mic_tcp_payload payload)
+{
+    int position = 0;
+
+    for (int indice = 0; position + 2 <= payload.size; indice++){
+        mic_tcp_payload message;
+        message.size = (unsigned char) payload.data[position] | ((unsigned char) payload.data[position + 1] << 8);
+        message.data = payload.data + position + 2;
+        if (position + 2 + message.size > payload.size){
+            break; // PDU incohérent
+        }
+        if (indice >= sock->messages_livres && app_ring_put(sock->reception, message) == -1){
+            sock->messages_livres = indice;
+            return -1;
+        }
+        position += 2 + message.size;
+    }
+    sock->messages_livres = 0;
+    return 0;
+}
+
+/*
+ * Remet à l'application le PDU attendu : un message non segmenté est livré
+ * tel quel, les segments sont réassemblés et le message est livré avec son
+ * dernier segment ; un message dont un segment a été sauté est abandonné
+ * Retourne -1 si le buffer applicatif est plein (le PDU reste à livrer), 0 sinon
+ */
+static int livrer(mic_tcp_sock* sock, mic_tcp_payload payload, unsigned char segment)
+{
+    if (segment & SEG_GROUPE){
+        sock->reassemblage = 0;
+        return livrer_groupe(sock, payload);
+    }
+    if (!(segment & SEG_CONT)){
+        sock->reassemblage = 0; // début d'un nouveau message
+    } else if (!sock->reassemblage){
+        return 0; // début du message perdu : segment ignoré
+    }
+    if (segment == 0){
+        return app_ring_put(sock->reception, payload);
+    }
+
+    int debut = sock->reassemblage ? sock->taille_message : 0;
+    if (debut + payload.size > sock->capacite_message){
+        sock->capacite_message = 2 * (debut + payload.size);
+        sock->message = realloc(sock->message, sock->capacite_message);
+    }
+    memcpy(sock->message + debut, payload.data, payload.size);
+    sock->taille_message = debut + payload.size;
+    sock->reassemblage = 1;
+    if (segment & SEG_SUITE){
+        return 0;
+    }
+
+    mic_tcp_payload message = { sock->message, sock->taille_message };
+    if (app_ring_put(sock->reception, message) == -1){
+        sock->taille_message = debut; // le dernier segment sera ajouté à nouveau
+        return -1;
+    }
+    sock->reassemblage = 0;
+    return 0;
+}
+
+/*
+ * Livre à l'application les PDU consécutifs disponibles dans le buffer de réordonnancement
+ * Retourne -1 si le buffer applicatif est plein (les PDU restent en attente), 0 sinon
+ */
+static int livrer_en_ordre(mic_tcp_sock* sock)
+{
+    pdu_recu* slot = &sock->tampon_reception[sock->PA % TAILLE_FENETRE_ENVOI_MAX];
+
+    while (slot->present){
+        mic_tcp_payload payload;
+        payload.data = slot->data;
+        payload.size = slot->size;
+        if (livrer(sock, payload, slot->segment) == -1){
+            __atomic_store_n(&sock->livraison_bloquee, 1, __ATOMIC_RELEASE);
+            return -1;
+        }
+        TRACE(TRACE_APP_DELIVER, sock->PA, 0, payload.size);
+        slot->present = 0;
+        sock->PA++;
+        slot = &sock->tampon_reception[sock->PA % TAILLE_FENETRE_ENVOI_MAX];
+    }
+    return 0;
+}
+
+/*
+ * L'émetteur a abandonné les PDU précédant base : on livre ceux qui sont
+ * arrivés et on saute les autres
+ */
+static void sauter_jusqua(mic_tcp_sock* sock, unsigned int base)
+{
+    while (seq_inf(sock->PA, base)){
+        if (livrer_en_ordre(sock) == -1){
+            return; // buffer applicatif plein, on reprendra au prochain PDU
+        }
+        if (!seq_inf(sock->PA, base)){
+            break;
+        }
+        sock->PA++; // PDU perdu et abandonné par l'émetteur
+        sock->reassemblage = 0; // le message auquel il appartenait est incomplet
+    }
+    livrer_en_ordre(sock);
+}
+
+/*
+ * Range un PDU de données reçu (ou reconstruit par la FEC) : livraison
+ * s'il est attendu, sinon mise de côté jusqu'à combler le trou
+ * Retourne -1 si le PDU ne doit pas être acquitté
+ */
+static int recevoir_donnees(mic_tcp_sock* sock, unsigned int seq, mic_tcp_payload payload, unsigned char segment)
+{
+    if (seq == sock->PA){
+        if (livrer(sock, payload, segment) == -1){
+            // buffer applicatif plein : pas d'ACK, l'émetteur retransmettra
+            return -1;
+        }
+        TRACE(TRACE_APP_DELIVER, sock->PA, 0, payload.size);
+        sock->PA++;
+        livrer_en_ordre(sock);
+    } else if (seq_inf(sock->PA, seq) && (seq - sock->PA) < TAILLE_FENETRE_ENVOI_MAX){
+        // PDU hors séquence : le garder jusqu'à combler le trou
+        pdu_recu* slot = &sock->tampon_reception[seq % TAILLE_FENETRE_ENVOI_MAX];
+        if (!slot->present){
+            copier_donnees(&slot->data, &slot->capacite, payload.data, payload.size);
+            slot->size = payload.size;
+            slot->segment = segment;
+            slot->present = 1;
+        } else {
+            STAT_AJOUTER(sock, doublons, 1);
+        }
+    } else if (!seq_inf(seq, sock->PA)){
+        // hors de la fenêtre de réception : pas d'ACK
+        return -1;
+    } else {
+        // déjà livré : l'ACK précédent a dû se perdre, on acquitte à nouveau
+        STAT_AJOUTER(sock, doublons, 1);
+    }
+    return 0;
+}
+
+/*
+ * Alloue un socket et l'ajoute à la table de sockets
+ */
+static mic_tcp_sock* creer_socket(void)
+{
+    mic_tcp_sock* sock = calloc(1, sizeof(mic_tcp_sock));
+
+    if (sock == NULL){
+        LOG_ERROR("erreur allocation socket\n");
+        exit(-1);
+    }
+    sock->fenetre_envoi = calloc(TAILLE_FENETRE_ENVOI_MAX, sizeof(pdu_en_vol));
+    sock->tampon_reception = calloc(TAILLE_FENETRE_ENVOI_MAX, sizeof(pdu_recu));
+    sock->reception = app_ring_new(0);
+    if (sock->fenetre_envoi == NULL || sock->tampon_reception == NULL || sock->reception == NULL){
+        LOG_ERROR("erreur allocation socket\n");
+        exit(-1);
+    }
+    pthread_mutex_init(&sock->verrou_envoi, NULL);
+    pthread_cond_init(&sock->cond_envoi, NULL);
+    pthread_mutex_init(&sock->verrou_reception, NULL);
+    pthread_mutex_init(&sock->verrou_attentes, NULL);
+    sock->state = IDLE; 
+    sock->rtt.rto = RTO_INITIAL;
+    sock->rto_min = RTO_MIN;
+    sock->taille_fenetre_envoi = TAILLE_FENETRE_ENVOI;
+    sock->fenetre_recepteur = TAILLE_FENETRE_ENVOI_MAX;
+    mic_tcp_cc_init(&sock->cc, &CC_DEFAUT);
+    for (int i = 0; i < TAILLE_FENETRE; i++){
+        sock->fenetre[i] = 1;
+    }
+
+    pthread_rwlock_wrlock(&verrou_tables);
+    if (nb_fds_libres > 0){
+        // reprendre le descripteur d'un socket libéré
+        sock->fd = fds_libres[--nb_fds_libres];
+    } else {
+        if (nb_fd == capacite_sockets){
+            // table pleine, on double sa taille
+            int capacite = (capacite_sockets == 0) ? NB_SOCKETS_INITIAL : 2 * capacite_sockets;
+            mic_tcp_sock** table = realloc(sockets, capacite * sizeof(mic_tcp_sock*));
+            int* libres = realloc(fds_libres, capacite * sizeof(int));
+            if (table == NULL || libres == NULL){
+                LOG_ERROR("erreur allocation table de sockets\n");
+                exit(-1);
+            }
+            sockets = table;
+            fds_libres = libres;
+            capacite_sockets = capacite;
+        }
+        sock->fd = nb_fd++; // definir le numero de soc
+    }
+    sockets[sock->fd] = sock; // mettre le sock dans la table de sockets.
+    pthread_rwlock_unlock(&verrou_tables);
+
+    sock->stats = stats_attach(sock->fd);
+    if (sock->stats == NULL){
+        sock->stats = &sock->stats_locales;
+    }
+    STAT_FIXER(sock, rto, sock->rtt.rto);
+
+    return sock;
+}
+
+/*
+ * Retire des tables un socket et ceux chaînés derrière lui par
+ * suivant_accept : plus aucun PDU ne leur est démultiplexé
+ */
+static void retirer_sockets(mic_tcp_sock* liste)
+{
+    pthread_rwlock_wrlock(&verrou_tables);
+    for (mic_tcp_sock* sock = liste; sock != NULL; sock = sock->suivant_accept){
+        retirer_hash(sock);
+        sockets[sock->fd] = NULL;
+    }
+    pthread_rwlock_unlock(&verrou_tables);
+}
+
+/*
+ * Libère la mémoire d'un socket retiré des tables et rend son descripteur
+ */
+static void detruire_socket(mic_tcp_sock* sock)
+{
+    for (int i = 0; i < TAILLE_FENETRE_ENVOI_MAX; i++){
+        free(sock->fenetre_envoi[i].data);
+        free(sock->tampon_reception[i].data);
+    }
+    free(sock->fenetre_envoi);
+    free(sock->tampon_reception);
+    for (int i = 0; i < sock->capacite_tampon; i++){
+        free(sock->tampon_envoi[i].data);
+    }
+    free(sock->tampon_envoi);
+    free(sock->groupe);
+    free(sock->message);
+    app_ring_destroy(sock->reception);
+    mic_tcp_fec_liberer(&sock->fec);
+    pthread_mutex_destroy(&sock->verrou_envoi);
+    pthread_cond_destroy(&sock->cond_envoi);
+    pthread_mutex_destroy(&sock->verrou_reception);
+    pthread_mutex_destroy(&sock->verrou_attentes);
+    stats_detach(sock->fd);
+
+    pthread_rwlock_wrlock(&verrou_tables);
+    fds_libres[nb_fds_libres++] = sock->fd;
+    pthread_rwlock_unlock(&verrou_tables);
+    free(sock);
+}
+
+/*
+ * Libère les sockets retirés des tables, chaînés par suivant_accept, une
+ * fois qu'aucun traitement de PDU commencé avant leur retrait ne les tient
+ * Appelée sans verrou_liberation
+ */
+static void liberer_sockets(mic_tcp_sock* liste)
+{
+    if (liste == NULL){
+        return;
+    }
+    pthread_rwlock_wrlock(&verrou_liberation);
+    pthread_rwlock_unlock(&verrou_liberation);
+    while (liste != NULL){
+        mic_tcp_sock* suivant = liste->suivant_accept;
+        detruire_socket(liste);
+        liste = suivant;
+    }
+}
+
+/*
+ * Permet de créer un socket entre l’application et MIC-TCP
+ * Retourne le descripteur du socket ou bien -1 en cas d'erreur
+ */
+int mic_tcp_socket(start_mode sm)
+{
+    int result = -1;
+    LOG_DEBUG("[MIC-TCP] Appel de la fonction: %s\n", __FUNCTION__);
+    result = initialize_components(sm); /* Appel obligatoire */
+
+    if (result != -1){
+        result = creer_socket()->fd;
+    } 
+
+    return result;
+}
+
+/*
+ * Permet d’attribuer une adresse à un socket.
+ * Retourne 0 si succès, et -1 en cas d’échec
+ */
+int mic_tcp_bind(int socket, mic_tcp_sock_addr addr)
+{
+    LOG_DEBUG("[MIC-TCP] Appel de la fonction: %s\n", __FUNCTION__);
+
+    mic_tcp_sock* sock = get_socket(socket);
+    int result = -1;
+
+    if (sock == NULL || sock->local_addr.port != 0 || addr.port == 0){
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&verrou_tables);
+    if (reserver_port(addr.port) == 0){
+        // le socket est en écoute sur ce port tant qu'il n'a pas de pair
+        sock->local_addr = addr;
+        inserer_hash(sock);
+        result = 0;
+    }
+    pthread_rwlock_unlock(&verrou_tables);
+    return result; 
+
+}
+
+/*
+ * Met le socket en état d'acceptation de connexions
+ * Retourne le descripteur du socket de la nouvelle connexion, -1 si erreur
+ */
+int mic_tcp_accept(int socket, mic_tcp_sock_addr* addr)
+{
+    LOG_DEBUG("[MIC-TCP] Appel de la fonction: %s\n", __FUNCTION__);
+    mic_tcp_sock* sock = get_socket(socket);
+    mic_tcp_sock* connexion = NULL;
+
+    if (sock == NULL || sock->local_addr.port == 0){
+        return -1;
+    }
+
+    if (pthread_mutex_lock(&mutex)){
+        LOG_ERROR("Erreur mutex lock\n");
+        exit(-1);
+    }
+
+    // attendre qu'une connexion de la file ait reçu l'ACK de sa poignée de main
+    while (connexion == NULL){
+        mic_tcp_sock** p = &sock->file_accept;
+        while (*p != NULL && (*p)->state != ACK_RECEIVED){
+            p = &(*p)->suivant_accept;
+        }
+        if (*p != NULL){
+            connexion = *p;
+            *p = connexion->suivant_accept;
+            connexion->suivant_accept = NULL;
+            sock->taille_file_accept--;
+        } else if (sock->non_bloquant){
+            pthread_mutex_unlock(&mutex);
+            errno = EAGAIN;
+            return -1;
+        } else {
+            pthread_cond_wait(&cond, &mutex);
+        }
+    }
+
+    // ACK bien reçu
+    connexion->state = CONNECTED;
+
+    if (pthread_mutex_unlock(&mutex)){
+        LOG_ERROR("Erreur mutex unlock\n");
+        exit(-1);
+    }
+
+    if (addr != NULL){
+        // l'adresse pointe dans le socket de la connexion, valable jusqu'à sa fermeture
+        *addr = connexion->remote_addr;
+    }
+    stats_describe(connexion->fd, connexion->local_addr.port, connexion->remote_addr.port);
+    return connexion->fd;
+}
+
+/*
+ * Permet de réclamer l’établissement d’une connexion
+ * Retourne 0 si la connexion est établie, et -1 en cas d’échec
+ */
+int mic_tcp_connect(int socket, mic_tcp_sock_addr addr)
+{
+    LOG_DEBUG("[MIC-TCP] Appel de la fonction: %s\n", __FUNCTION__);
+    int result = -1;
+    int ctrl_syn_ack = 0;
+    mic_tcp_sock* sock = get_socket(socket);
+
+    if (sock == NULL){
+        return -1;
+    }
+
+    // résoudre l'adresse distante une fois pour toute la connexion
+    struct sockaddr_in remote_sockaddr;
+    if (IP_resolve(addr.ip_addr, &remote_sockaddr) == -1){
+        LOG_ERROR("erreur resolution adresse\n");
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&verrou_tables);
+    retirer_hash(sock);
+    if (sock->local_addr.port == 0){
+        // socket non lié : lui attribuer un port éphémère
+        sock->local_addr.port = port_ephemere();
+    }
+    sock->remote_addr = addr;
+    sock->remote_sockaddr = remote_sockaddr;
+    inserer_hash(sock);
+    pthread_rwlock_unlock(&verrou_tables);
+
+    mic_tcp_sock_addr local_addr = sock->local_addr;
+    mic_tcp_sock_addr remote_addr = sock->remote_addr;
+
+    if (local_addr.port != 0){
+
+        // création pdu SYN
+        mic_tcp_pdu syn;
+        memset(&syn, 0, sizeof(syn));
+        syn.header.source_port = local_addr.port;
+        syn.header.dest_port = remote_addr.port;
+        syn.header.ack = 0;
+        syn.header.syn = 1;
+        syn.header.fec = 0;
+        syn.header.segment = 0;
+        syn.header.taille_options = 0;
+
+        // mettre le choix de taux de pertes tolérés (loss_rate) et la FEC demandée dans le payload de SYN
+        mic_tcp_negociation proposition;
+        memset(&proposition, 0, sizeof(proposition));
+        proposition.loss_rate = CLIENT_LOSS_RATE;
+        proposition.fec = sock->fec.mode;
+        proposition.fec_k = sock->fec.k;
+        proposition.fec_m = sock->fec.m;
+        syn.payload.size = sizeof(proposition);
+        syn.payload.data = (char*) &proposition;
+
+        // le SYN-ACK doit arriver ici, pas au thread de protocole ni à mic_tcp_poll
+        pthread_mutex_lock(&verrou_poignee);
+
+        // envoyer pdu SYN
+        unsigned long date_syn = get_now_time_usec();
+        unsigned long dernier_syn = date_syn;
+        int nb_syn = 1;
+        if (IP_send_resolved(syn, &sock->remote_sockaddr) == -1){
+            LOG_ERROR("erreur a envoyer ack\n");
+        } 
+
+        // ouvrir des mémoire necessaire pour le récuperation de SYN_ACK
+        mic_tcp_pdu syn_ack;
+        mic_tcp_ip_addr local_ip;
+        mic_tcp_ip_addr remote_ip;
+
+        // allocation de mémoire
+        local_ip.addr_size = IP_ADDR_MAX_LEN;
+        local_ip.addr = malloc(IP_ADDR_MAX_LEN);
+        remote_ip.addr_size = IP_ADDR_MAX_LEN;
+        remote_ip.addr = malloc(IP_ADDR_MAX_LEN);
+        mic_tcp_negociation retenu;
+        syn_ack.payload.data = (char*) &retenu;
+
+        while (ctrl_syn_ack == 0){
+            // récuperer pdu SYN_ACK
+            syn_ack.payload.size = sizeof(retenu);
+            int recv_syn_ack = IP_recv(&syn_ack, &local_ip, &remote_ip, rto_msec(sock));
+
+            // ACK d'une autre connexion de ce processus : le traiter, et ne
+            // renvoyer le SYN qu'au bout du timeout
+            if ((recv_syn_ack != -1) && (syn_ack.header.ack == 1) && (syn_ack.header.syn == 0)){
+                aiguiller_ack(syn_ack);
+                if (get_now_time_usec() - dernier_syn < sock->rtt.rto){
+                    continue;
+                }
+                recv_syn_ack = -1;
+            }
+
+            // vérifier s'il est bien SYN_ACK
+            if ((recv_syn_ack != -1) && (syn_ack.header.ack == 1) && (syn_ack.header.syn == 1)){
+                ctrl_syn_ack =1;
+
+                // adopter la FEC retenue par le serveur (aucune s'il n'en parle pas)
+                if (syn_ack.payload.size == sizeof(retenu)){
+                    sock->perte_tolere = retenu.loss_rate;
+                    if (mic_tcp_fec_init(&sock->fec, retenu.fec, retenu.fec_k, retenu.fec_m) == -1){
+                        mic_tcp_fec_init(&sock->fec, FEC_AUCUN, 0, 0);
+                    }
+                } else {
+                    mic_tcp_fec_init(&sock->fec, FEC_AUCUN, 0, 0);
+                }
+
+                // première mesure de RTT, sauf si le SYN a été retransmis (règle de Karn)
+                if (nb_syn == 1){
+                    mesurer_rtt(sock, get_now_time_usec() - date_syn);
+                }
+
+                // création pdu ACK
+                mic_tcp_pdu ack;
+                memset(&ack, 0, sizeof(ack));
+                ack.header.source_port = local_addr.port;
+                ack.header.dest_port = remote_addr.port;
+                ack.header.ack = 1;
+                ack.header.syn = 0;
+                ack.header.fec = 0;
+                ack.header.segment = 0;
+                ack.header.rwnd = TAILLE_FENETRE_ENVOI_MAX;
+                ack.header.taille_options = 0;
+                ack.payload.size = 0;
+                ack.payload.data = NULL;
+
+                // envoyer ACK
+                if (IP_send_resolved(ack, &sock->remote_sockaddr) == -1){
+                    LOG_ERROR("erreur a envoyer ack\n");
+                } else {
+                    sock->state = CONNECTED;
+                    stats_describe(sock->fd, sock->local_addr.port, sock->remote_addr.port);
+                    result = 0;
+                }
+
+                // Continuer à écouter d'éventuels SYN-ACK dupliqués
+                int wait = 1;
+                int wait_count = 0;
+                while (wait && wait_count < 5) { // 5 tentatives max
+                    int again = IP_recv(&syn_ack, &local_ip, &remote_ip, rto_msec(sock));
+                    if ((again != -1) && (syn_ack.header.ack == 1) && (syn_ack.header.syn == 1)) {
+                        // Renvoyer l'ACK si SYN-ACK dupliqué reçu
+                        if (IP_send_resolved(ack, &sock->remote_sockaddr) == -1){
+                            LOG_ERROR("erreur a renvoyer ack\n");
+                        }
+                        wait_count++;
+                    } else {
+                        if (again != -1){
+                            aiguiller_ack(syn_ack);
+                        }
+                        wait = 0;
+                    }
+                }
+            } else {
+                // renvoyer SYN si pas reçu SYN_ACK
+                if (recv_syn_ack == -1){
+                    doubler_rto(sock);
+                }
+                nb_syn++;
+                dernier_syn = get_now_time_usec();
+                if (IP_send_resolved(syn, &sock->remote_sockaddr) == -1){
+                    LOG_ERROR("erreur a envoyer ack\n");
+                } 
+            }
+        } 
+        pthread_mutex_unlock(&verrou_poignee);
+    } else {
+        result = -1;
+    } 
+
+    return result;
+}
+
+/*
+ * Place un segment dans la fenêtre d'envoi, qui doit avoir de la place, et
+ * l'émet ; echeance est la date (usec) au-delà de laquelle il ne sera plus
+ * retransmis, 0 si aucune
+ * Retourne la taille des données envoyées, et -1 en cas d'erreur
+ */
+static int placer_segment(mic_tcp_sock* sock, const char* mesg, int mesg_size, unsigned char segment, unsigned long echeance)
+{
+    int send = -1;
+
+    // mettre le message dans la fenêtre
+    pdu_en_vol* slot = &sock->fenetre_envoi[sock->PE % TAILLE_FENETRE_ENVOI_MAX];
+    copier_donnees(&slot->data, &slot->capacite, mesg, mesg_size);
+    slot->size = mesg_size;
+    slot->seq = sock->PE;
+    slot->etat = EN_VOL;
+    slot->nb_envois = 0;
+    slot->echeance = echeance;
+    slot->segment = segment;
+    sock->PE++;
+
+    // envoyer le pdu a address remote ip
+    if ((send = emettre_pdu(sock, slot)) == -1){
+        LOG_ERROR("error envoyer pdu\n");
+    } 
+
+    // dernier PDU d'un groupe FEC : envoyer ses parités
+    if (sock->fec.mode != FEC_AUCUN && sock->PE % sock->fec.k == 0){
+        emettre_parites(sock, sock->PE - sock->fec.k);
+    }
+    return send;
+}
+
+/*
+ * Attend une place dans la fenêtre d'envoi, puis y place le segment
+ * Appelée sous le verrou d'émission, relâché pendant les attentes
+ * Retourne la taille des données envoyées, 0 si l'échéance est passée
+ * avant l'émission, et -1 en cas d'erreur
+ */
+static int envoyer_segment(mic_tcp_sock* sock, char* mesg, int mesg_size, unsigned char segment, unsigned long echeance)
+{
+    // attendre une place dans la fenêtre d'envoi
+    attendre_fenetre(sock, fenetre_effective(sock) - 1);
+
+    // respecter l'écart minimal entre deux émissions demandé par le module
+    unsigned long ecart = mic_tcp_cc_pacing(&sock->cc, sock->rtt.srtt);
+    if (ecart > 0){
+        unsigned long now = get_now_time_usec();
+        if (now < sock->prochain_envoi){
+            pthread_mutex_unlock(&sock->verrou_envoi);
+            wait_until_usec(sock->prochain_envoi);
+            pthread_mutex_lock(&sock->verrou_envoi);
+            now = sock->prochain_envoi;
+        }
+        sock->prochain_envoi = now + ecart;
+    }
+
+    // l'attente a pu suffire à rendre le message inutile
+    if (echeance != 0 && get_now_time_usec() >= echeance){
+        return 0;
+    }
+    return placer_segment(sock, mesg, mesg_size, segment, echeance);
+}
+
+/*
+ * Découpe un message en segments d'au plus MSS octets, émis à la suite
+ * dans la fenêtre d'envoi
+ * Retourne la taille du message, 0 si l'échéance est passée avant la fin
+ * de l'émission, et -1 en cas d'erreur
+ */
+static int envoyer(mic_tcp_sock* sock, char* mesg, int mesg_size, unsigned long echeance)
+{
+    int envoye = 0;
+
+    do {
+        int taille = (mesg_size - envoye > MSS) ? MSS : mesg_size - envoye;
+        unsigned char segment = 0;
+        if (envoye > 0){
+            segment |= SEG_CONT;
+        }
+        if (envoye + taille < mesg_size){
+            segment |= SEG_SUITE;
+        }
+        int send = envoyer_segment(sock, mesg + envoye, taille, segment, echeance);
+        if (send == -1 || (send == 0 && taille > 0)){
+            return send;
+        }
+        envoye += taille;
+    } while (envoye < mesg_size);
+
+    return mesg_size;
+}
+
+/*
+ * Émet les messages en attente de regroupement : un PDU SEG_GROUPE, ou un
+ * PDU ordinaire s'il n'y en a qu'un
+ * Retourne 0 si succès, et -1 en cas d'erreur
+ */
+static int vider_groupe(mic_tcp_sock* sock)
+{
+    int send = 0;
+
+    if (sock->nb_groupe == 1){
+        send = envoyer(sock, sock->groupe + 2, sock->taille_groupe - 2, 0);
+    } else if (sock->nb_groupe > 1){
+        send = envoyer_segment(sock, sock->groupe, sock->taille_groupe, SEG_GROUPE, 0);
+    }
+    sock->taille_groupe = 0;
+    sock->nb_groupe = 0;
+    return (send == -1) ? -1 : 0;
+}
+
+/*
+ * Ajoute un message au groupe, qui doit avoir la place de le recevoir
+ */
+static void ajouter_au_groupe(mic_tcp_sock* sock, const char* mesg, int mesg_size)
+{
+    sock->groupe[sock->taille_groupe] = mesg_size & 0xff;
+    sock->groupe[sock->taille_groupe + 1] = mesg_size >> 8;
+    memcpy(sock->groupe + sock->taille_groupe + 2, mesg, mesg_size);
+    sock->taille_groupe += 2 + mesg_size;
+    sock->nb_groupe++;
+}
+
+/*
+ * Mode regroupement, à la manière de l'algorithme de Nagle : un petit
+ * message part aussitôt si aucun PDU n'est en vol, sinon il attend dans
+ * le groupe jusqu'à ce que le groupe soit plein, qu'un envoi trouve la
+ * fenêtre vide, ou que l'application appelle mic_tcp_flush
+ * Retourne la taille du message, et -1 en cas d'erreur
+ */
+static int regrouper(mic_tcp_sock* sock, char* mesg, int mesg_size)
+{
+    // un message trop grand pour un groupe part seul, après ceux en attente
+    if (mesg_size + 2 > MSS){
+        if (vider_groupe(sock) == -1){
+            return -1;
+        }
+        return envoyer(sock, mesg, mesg_size, 0);
+    }
+
+    if (sock->taille_groupe + 2 + mesg_size > MSS && vider_groupe(sock) == -1){
+        return -1;
+    }
+    ajouter_au_groupe(sock, mesg, mesg_size);
+
+    // plus rien en vol : attendre ne regrouperait rien de plus
+    if (sock->PE == sock->base_envoi && vider_groupe(sock) == -1){
+        return -1;
+    }
+    return mesg_size;
+}
+
+/*
+ * Vrai quand tout ce que l'application a confié au socket est acquitté ou
+ * abandonné : tampon d'envoi, groupe et fenêtre d'envoi
+ */
+static int tout_acquitte(mic_tcp_sock* sock)
+{
+    return sock->tete_tampon == sock->queue_tampon && sock->nb_groupe == 0 && sock->PE == sock->base_envoi;
+}
+
+/*
+ * Thread de protocole : place le groupe en attente dans la fenêtre, qui
+ * doit avoir de la place
+ */
+static void placer_groupe(mic_tcp_sock* sock)
+{
+    if (sock->nb_groupe == 1){
+        placer_segment(sock, sock->groupe + 2, sock->taille_groupe - 2, 0, 0);
+    } else {
+        placer_segment(sock, sock->groupe, sock->taille_groupe, SEG_GROUPE, 0);
+    }
+    sock->taille_groupe = 0;
+    sock->nb_groupe = 0;
+    sock->vidage = 0;
+}
+
+/*
+ * Thread de protocole : passe au message suivant du tampon d'envoi
+ */
+static void retirer_message(mic_tcp_sock* sock)
+{
+    sock->tete_tampon++;
+    sock->envoye_tete = 0;
+}
+
+/*
+ * Thread de protocole : gère les retransmissions du socket, puis place dans
+ * la fenêtre d'envoi les messages du tampon tant qu'elle a de la place,
+ * avec les mêmes règles de segmentation, de regroupement, d'échéance et
+ * d'écart entre émissions que l'envoi synchrone
+ * Appelée sous le verrou d'émission
+ * Retourne le délai (usec) avant que le socket ait de nouveau besoin du
+ * thread hors arrivée d'un ACK, -1 si aucun
+ */
+static long servir_tampon(mic_tcp_sock* sock)
+{
+    long attente = -1;
+    long delai;
+
+    if (sock->tampon_envoi == NULL){
+        return -1;
+    }
+    if (prochaine_expiration(sock) == 0){
+        traiter_expirations(sock);
+    }
+
+    while (1){
+        message_en_attente* m = NULL;
+        unsigned long now = get_now_time_usec();
+
+        if (sock->tete_tampon != sock->queue_tampon){
+            m = &sock->tampon_envoi[sock->tete_tampon % sock->capacite_tampon];
+            // l'attente a pu suffire à rendre le message inutile
+            if (m->echeance != 0 && now >= m->echeance){
+                retirer_message(sock);
+                continue;
+            }
+            // un petit message sans échéance rejoint le groupe
+            if (sock->regroupement && sock->envoye_tete == 0 && m->echeance == 0 && m->size + 2 <= MSS
+                && sock->taille_groupe + 2 + m->size <= MSS){
+                ajouter_au_groupe(sock, m->data, m->size);
+                retirer_message(sock);
+                continue;
+            }
+        }
+
+        // le groupe part avant le message suivant, ou dès que rien n'est plus en vol
+        int groupe = sock->nb_groupe > 0
+            && (m != NULL || !sock->regroupement || sock->vidage || sock->PE == sock->base_envoi);
+        if ((!groupe && m == NULL) || places_libres(sock) == 0){
+            break;
+        }
+
+        // respecter l'écart minimal entre deux émissions demandé par le module
+        unsigned long ecart = mic_tcp_cc_pacing(&sock->cc, sock->rtt.srtt);
+        if (ecart > 0){
+            if (now < sock->prochain_envoi){
+                attente = sock->prochain_envoi - now;
+                break;
+            }
+            sock->prochain_envoi = now + ecart;
+        }
+
+        if (groupe){
+            placer_groupe(sock);
+            continue;
+        }
+
+        // segment suivant du message de tête
+        int taille = (m->size - sock->envoye_tete > MSS) ? MSS : m->size - sock->envoye_tete;
+        unsigned char segment = 0;
+        if (sock->envoye_tete > 0){
+            segment |= SEG_CONT;
+        }
+        if (sock->envoye_tete + taille < m->size){
+            segment |= SEG_SUITE;
+        }
+        placer_segment(sock, m->data + sock->envoye_tete, taille, segment, m->echeance);
+        sock->envoye_tete += taille;
+        if (sock->envoye_tete >= m->size){
+            retirer_message(sock);
+        }
+    }
+
+    // de la place dans le tampon, ou tout est acquitté
+    pthread_cond_broadcast(&sock->cond_envoi);
+    reveiller(sock);
+
+    delai = prochaine_expiration(sock);
+    if (delai >= 0 && (attente == -1 || delai * 1000 < attente)){
+        attente = delai * 1000;
+    }
+    return attente;
+}
+
+/*
+ * Thread de protocole (côté client) : lit les ACK, gère les retransmissions
+ * et vide les tampons d'envoi, pendant que l'application continue
+ */
+static void* protocole(void* arg)
+{
+    int ip_fd = IP_recv_fd();
+
+    while (1){
+        uint64_t valeur;
+        long attente = -1;
+
+        // remis à zéro avant de regarder les tampons, qu'un message déposé
+        // entre-temps ne soit pas oublié
+        while (read(eventfd_protocole, &valeur, sizeof(valeur)) > 0);
+        // pendant un mic_tcp_connect, repasser régulièrement sans lire le socket UDP
+        int lecture = (recuperer_acks() == 0);
+        if (!lecture){
+            attente = ATTENTE_POIGNEE;
+        }
+
+        pthread_mutex_lock(&verrou_protocole);
+        for (mic_tcp_sock* sock = sockets_protocole; sock != NULL; sock = sock->suivant_protocole){
+            pthread_mutex_lock(&sock->verrou_envoi);
+            long delai = servir_tampon(sock);
+            pthread_mutex_unlock(&sock->verrou_envoi);
+            if (delai >= 0 && (attente == -1 || delai < attente)){
+                attente = delai;
+            }
+        }
+        pthread_mutex_unlock(&verrou_protocole);
+
+        // dormir jusqu'à un ACK, un nouveau message ou la prochaine échéance
+        struct timespec duree = { attente / 1000000, (attente % 1000000) * 1000 };
+        struct pollfd attendus[2] = { { eventfd_protocole, POLLIN, 0 }, { ip_fd, POLLIN, 0 } };
+        ppoll(attendus, lecture ? 2 : 1, (attente >= 0) ? &duree : NULL, NULL);
+    }
+    return NULL;
+}
+
+static void lancer_protocole(void)
+{
+    if ((eventfd_protocole = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1){
+        LOG_ERROR("erreur creation eventfd du thread de protocole\n");
+        return;
+    }
+    if (pthread_create(&thread_protocole, NULL, protocole, NULL) != 0){
+        LOG_ERROR("erreur creation du thread de protocole\n");
+        close(eventfd_protocole);
+        eventfd_protocole = -1;
+    }
+}
+
+/*
+ * Ajoute (inscrire != 0) ou retire un socket de ceux que sert le thread de protocole
+ */
+static void inscrire_protocole(mic_tcp_sock* sock, int inscrire)
+{
+    pthread_mutex_lock(&verrou_protocole);
+    if (inscrire){
+        sock->suivant_protocole = sockets_protocole;
+        sockets_protocole = sock;
+    } else {
+        mic_tcp_sock** p = &sockets_protocole;
+        while (*p != NULL && *p != sock){
+            p = &(*p)->suivant_protocole;
+        }
+        if (*p != NULL){
+            *p = sock->suivant_protocole;
+        }
+    }
+    pthread_mutex_unlock(&verrou_protocole);
+}
+
+/*
+ * Copie un message dans le tampon d'envoi, en attendant une place s'il est plein
+ * Appelée sous le verrou d'émission
+ * Retourne la taille du message, et -1 (errno = EAGAIN) si le tampon est
+ * plein en mode non bloquant
+ */
+static int deposer(mic_tcp_sock* sock, const char* mesg, int mesg_size, unsigned long echeance)
+{
+    while (sock->queue_tampon - sock->tete_tampon == (unsigned int) sock->capacite_tampon){
+        if (sock->non_bloquant){
+            errno = EAGAIN;
+            return -1;
+        }
+        pthread_cond_wait(&sock->cond_envoi, &sock->verrou_envoi);
+    }
+
+    message_en_attente* m = &sock->tampon_envoi[sock->queue_tampon % sock->capacite_tampon];
+    copier_donnees(&m->data, &m->capacite, mesg, mesg_size);
+    m->size = mesg_size;
+    m->echeance = echeance;
+
+    // le thread de protocole ne dort sans attendre d'ACK que si le tampon était vide
+    if (sock->queue_tampon++ == sock->tete_tampon){
+        reveiller_protocole();
+    }
+    return mesg_size;
+}
+
+/*
+ * Attend que tout ce que l'application a confié au socket soit acquitté ou
+ * abandonné, les messages regroupés partant sans attendre
+ * Appelée sous le verrou d'émission
+ * Retourne 0 si succès, et -1 en cas d'erreur
+ */
+static int attendre_acquittement(mic_tcp_sock* sock)
+{
+    if (sock->tampon_envoi == NULL){
+        if (vider_groupe(sock) == -1){
+            return -1;
+        }
+        attendre_fenetre(sock, 0);
+        return 0;
+    }
+
+    sock->vidage = 1;
+    reveiller_protocole();
+    while (!tout_acquitte(sock)){
+        pthread_cond_wait(&sock->cond_envoi, &sock->verrou_envoi);
+    }
+    return 0;
+}
+
+/*
+ * Permet de réclamer l’envoi d’une donnée applicative
+ * Le message est copié dans la fenêtre d'envoi : l'appel ne bloque que si
+ * la fenêtre est pleine, le temps de recevoir des ACK ou de gérer les pertes.
+ * Avec un tampon d'envoi (mic_tcp_set_send_buffer), il est copié dans le
+ * tampon et l'appel ne bloque que si le tampon est plein
+ * Retourne la taille des données envoyées, et -1 en cas d'erreur
+ */
+int mic_tcp_send (int mic_sock, char* mesg, int mesg_size)
+{
+    LOG_DEBUG("[MIC-TCP] Appel de la fonction: %s\n", __FUNCTION__);
+
+    int send;
+    // socket
+    mic_tcp_sock* sock = get_socket(mic_sock);
+
+    if (sock == NULL || sock->state != CONNECTED){
+        return -1;
+    }
+    if (sock->non_bloquant && sock->tampon_envoi == NULL){
+        recuperer_acks();
+    }
+
+    pthread_mutex_lock(&sock->verrou_envoi);
+    if (sock->tampon_envoi != NULL){
+        send = deposer(sock, mesg, mesg_size, 0);
+    } else if (sock->non_bloquant && !pret_a_envoyer(sock, mesg_size)){
+        errno = EAGAIN;
+        send = -1;
+    } else if (sock->regroupement){
+        send = regrouper(sock, mesg, mesg_size);
+    } else {
+        send = envoyer(sock, mesg, mesg_size, 0);
+    }
+    pthread_mutex_unlock(&sock->verrou_envoi);
+    return send;
+}
+
+/*
+ * Comme mic_tcp_send, pour un message utile seulement pendant ttl usec :
+ * passé ce délai il n'est plus retransmis (quelle que soit la politique de
+ * pertes tolérées) et le récepteur le saute
+ * Retourne la taille des données envoyées, 0 si le message était déjà
+ * périmé, et -1 en cas d'erreur
+ */
+int mic_tcp_send_deadline (int mic_sock, char* mesg, int mesg_size, long ttl)
+{
+    LOG_DEBUG("[MIC-TCP] Appel de la fonction: %s\n", __FUNCTION__);
+
+    int send;
+    mic_tcp_sock* sock = get_socket(mic_sock);
+
+    if (sock == NULL || sock->state != CONNECTED){
+        return -1;
+    }
+    if (ttl <= 0){
+        return 0;
+    }
+    if (sock->non_bloquant && sock->tampon_envoi == NULL){
+        recuperer_acks();
+    }
+
+    pthread_mutex_lock(&sock->verrou_envoi);
+    if (sock->tampon_envoi != NULL){
+        send = deposer(sock, mesg, mesg_size, get_now_time_usec() + ttl);
+    } else if (sock->non_bloquant && places_libres(sock) < ((sock->nb_groupe > 0) ? 2 : 1)){
+        errno = EAGAIN;
+        send = -1;
+    } else if (vider_groupe(sock) == -1){
+        // les messages regroupés plus tôt partent avant celui-ci
+        send = -1;
+    } else {
+        send = envoyer(sock, mesg, mesg_size, get_now_time_usec() + ttl);
+    }
+    pthread_mutex_unlock(&sock->verrou_envoi);
+    return send;
+}
+
+/*
+ * Permet de régler le nombre de PDU pouvant être en vol simultanément
+ * Retourne 0 si succès, et -1 en cas d'erreur
+ */
+int mic_tcp_set_send_window(int socket, int taille)
+{
+    mic_tcp_sock* sock = get_socket(socket);
+
+    if (sock == NULL || taille < 1 || taille > TAILLE_FENETRE_ENVOI_MAX){
+        return -1;
+    }
+    pthread_mutex_lock(&sock->verrou_envoi);
+    sock->taille_fenetre_envoi = taille;
+    pthread_mutex_unlock(&sock->verrou_envoi);
+    return 0;
+}
+
+/*
+ * Permet de fixer la borne basse du RTO (usec), entre 1 et RTO_MAX ; le RTO
+ * courant, et donc le RTO initial, ne descend pas sous cette borne
+ * Retourne 0 si succès, et -1 en cas d'erreur
+ */
+int mic_tcp_set_rto_min(int socket, unsigned long usec)
+{
+    mic_tcp_sock* sock = get_socket(socket);
+
+    if (sock == NULL || usec < 1 || usec > RTO_MAX){
+        return -1;
+    }
+    pthread_mutex_lock(&sock->verrou_envoi);
+    sock->rto_min = usec;
+    if (sock->rtt.rto < usec){
+        sock->rtt.rto = usec;
+        STAT_FIXER(sock, rto, sock->rtt.rto);
+    }
+    pthread_mutex_unlock(&sock->verrou_envoi);
+    return 0;
+}
+
+/*
+ * Permet de choisir le contrôle de congestion d'un socket ("reno", "cubic",
+ * ou "fixe" pour s'en tenir à la fenêtre d'envoi)
+ * Retourne 0 si succès, et -1 en cas d'erreur
+ */
+int mic_tcp_set_cc(int socket, const char* module)
+{
+    mic_tcp_sock* sock = get_socket(socket);
+    const mic_tcp_cc_ops* ops = mic_tcp_cc_trouver(module);
+
+    if (sock == NULL || ops == NULL){
+        return -1;
+    }
+    pthread_mutex_lock(&sock->verrou_envoi);
+    mic_tcp_cc_init(&sock->cc, ops);
+    pthread_mutex_unlock(&sock->verrou_envoi);
+    return 0;
+}
+
+/*
+ * Permet de demander, avant mic_tcp_connect, l'envoi de m PDU de parité
+ * (FEC_XOR : m = 1, ou FEC_RS) pour chaque groupe de k PDU de données ;
+ * le serveur peut réduire m, ou refuser la FEC. Les messages doivent
+ * laisser 2 octets de marge dans un PDU pour la taille du symbole.
+ * Retourne 0 si succès, et -1 en cas d'erreur
+ */
+int mic_tcp_set_fec(int socket, int mode, int k, int m)
+{
+    mic_tcp_sock* sock = get_socket(socket);
+
+    if (sock == NULL || sock->state != IDLE){
+        return -1;
+    }
+    return mic_tcp_fec_init(&sock->fec, mode, k, m);
+}
+
+/*
+ * Permet d'activer (actif = 1) ou de désactiver le regroupement des petits
+ * messages envoyés pendant qu'un PDU est en vol ; les limites des messages
+ * sont conservées à la réception
+ * Retourne 0 si succès, et -1 en cas d'erreur
  */
-int mic_tcp_bind(int socket, mic_tcp_sock_addr addr)
+int mic_tcp_set_coalescing(int socket, int actif)
 {
-    printf("[MIC-TCP] Appel de la fonction: ");  printf(__FUNCTION__); printf("\n");
+    mic_tcp_sock* sock = get_socket(socket);
 
-    for (int i = 0; i < MAX_SOCKET; i++){
-        if (i != socket && sockets[socket].local_addr.port == addr.port){
-            return -1;
-        } 
-    } 
-    sockets[socket].local_addr = addr;
-    return 0; 
+    if (sock == NULL){
+        return -1;
+    }
 
+    pthread_mutex_lock(&sock->verrou_envoi);
+    if (!actif && sock->tampon_envoi == NULL && vider_groupe(sock) == -1){
+        pthread_mutex_unlock(&sock->verrou_envoi);
+        return -1;
+    }
+    if (actif && sock->groupe == NULL){
+        sock->groupe = malloc(MSS);
+        if (sock->groupe == NULL){
+            pthread_mutex_unlock(&sock->verrou_envoi);
+            return -1;
+        }
+    }
+    sock->regroupement = actif;
+    if (!actif && sock->tampon_envoi != NULL){
+        reveiller_protocole(); // le groupe part sans attendre
+    }
+    pthread_mutex_unlock(&sock->verrou_envoi);
+    return 0;
 }
 
 /*
- * Met le socket en état d'acceptation de connexions
- * Retourne 0 si succès, -1 si erreur
+ * Permet d'émettre sans attendre les messages retenus par le regroupement,
+ * puis d'attendre que tout ce qui a été envoyé soit acquitté (ou abandonné
+ * par la fiabilité partielle) ; en mode non bloquant, retourne -1 avec
+ * errno = EAGAIN tant que ce n'est pas le cas
+ * Retourne 0 si succès, et -1 en cas d'erreur
  */
-int mic_tcp_accept(int socket, mic_tcp_sock_addr* addr)
+int mic_tcp_flush(int socket)
 {
-    printf("[MIC-TCP] Appel de la fonction: ");  printf(__FUNCTION__); printf("\n");
-    int result = -1;
+    mic_tcp_sock* sock = get_socket(socket);
+    int result = 0;
 
-    if (pthread_mutex_lock(&mutex)){
-        printf("Erreur mutex lock\n");
-        exit(-1);
+    if (sock == NULL || sock->state != CONNECTED){
+        return -1;
     }
-
-    // attendre le condition à réaliser
-    pthread_cond_wait(&cond, &mutex);
-
-    if (pthread_mutex_unlock(&mutex)){
-        printf("Erreur mutex unlock\n");
-        exit(-1);
+    if (sock->non_bloquant && sock->tampon_envoi == NULL){
+        recuperer_acks();
     }
 
-    // ACK bien reçu
-    sockets[socket].state = CONNECTED;
-    result = 0;
+    pthread_mutex_lock(&sock->verrou_envoi);
+    if (!sock->non_bloquant){
+        result = attendre_acquittement(sock);
+    } else {
+        if (sock->tampon_envoi != NULL){
+            sock->vidage = 1;
+            reveiller_protocole();
+        } else if (sock->nb_groupe > 0 && places_libres(sock) > 0){
+            result = vider_groupe(sock);
+        }
+        if (result == 0 && !tout_acquitte(sock)){
+            errno = EAGAIN;
+            result = -1;
+        }
+    }
+    pthread_mutex_unlock(&sock->verrou_envoi);
     return result;
 }
 
 /*
- * Permet de réclamer l’établissement d’une connexion
- * Retourne 0 si la connexion est établie, et -1 en cas d’échec
+ * Côté client, donne au socket un tampon d'envoi de taille messages :
+ * mic_tcp_send y copie le message et retourne aussitôt, et un thread de
+ * protocole se charge de l'émission, des retransmissions et des ACK.
+ * L'appel ne bloque plus que si le tampon est plein. taille = 0 revient à
+ * l'envoi synchrone ; le tampon précédent est d'abord entièrement acquitté
+ * Retourne 0 si succès, et -1 en cas d'erreur
  */
-int mic_tcp_connect(int socket, mic_tcp_sock_addr addr)
+int mic_tcp_set_send_buffer(int socket, int taille)
 {
-    printf("[MIC-TCP] Appel de la fonction: ");  printf(__FUNCTION__); printf("\n");
-    int result = -1;
-    int ctrl_syn_ack = 0;
-
-    sockets[socket].remote_addr  = addr;
-    mic_tcp_sock sock = sockets[socket];   
-    mic_tcp_sock_addr local_addr = sock.local_addr;
-    mic_tcp_sock_addr remote_addr = sock.remote_addr;
-
-    if (socket == sock.fd){
+    mic_tcp_sock* sock = get_socket(socket);
+    message_en_attente* tampon = NULL;
+    int actif;
 
-        // création pdu SYN
-        mic_tcp_pdu syn;
-        syn.header.source_port = local_addr.port;
-        syn.header.dest_port = remote_addr.port;
-        syn.header.ack = 0;
-        syn.header.syn = 1;
-
-        // mettre le choix de taux de pertes tolérés (loss_rate) de client dans le payload de SYN
-        int client_loss_rate = CLIENT_LOSS_RATE;
-        syn.payload.size = sizeof(int);
-        syn.payload.data = malloc(sizeof(int));
-        memcpy(syn.payload.data, &client_loss_rate, sizeof(int));
-
-        // envoyer pdu SYN
-        if (IP_send(syn, addr.ip_addr) == -1){
-            printf("erreur a envoyer ack\n");
-        } 
-
-        // ouvrir des mémoire necessaire pour le récuperation de SYN_ACK
-        mic_tcp_pdu syn_ack;
-        mic_tcp_ip_addr local_ip;
-        mic_tcp_ip_addr remote_ip;
-
-        // allocation de mémoire
-        local_ip.addr_size = IP_ADDR_MAX_LEN;
-        local_ip.addr = malloc(IP_ADDR_MAX_LEN);
-        remote_ip.addr_size = IP_ADDR_MAX_LEN;
-        remote_ip.addr = malloc(IP_ADDR_MAX_LEN);
-        syn_ack.payload.size = sizeof(int);
-        syn_ack.payload.data = malloc(sizeof(int)); 
-
-        while (ctrl_syn_ack == 0){
-            // récuperer pdu SYN_ACK
-            int recv_syn_ack = IP_recv(&syn_ack, &local_ip, &remote_ip, TIMEOUT);
+    // côté serveur, les ACK sont lus par les threads de réception
+    if (sock == NULL || taille < 0 || IP_recv_fd() == -1){
+        return -1;
+    }
+    pthread_once(&protocole_lance, lancer_protocole);
+    if (eventfd_protocole == -1){
+        return -1;
+    }
+    if (taille > 0 && (tampon = calloc(taille, sizeof(message_en_attente))) == NULL){
+        return -1;
+    }
 
-            // vérifier s'il est bien SYN_ACK
-            if ((recv_syn_ack != -1) && (syn_ack.header.ack == 1) && (syn_ack.header.syn == 1)){
-                ctrl_syn_ack =1;
+    pthread_mutex_lock(&sock->verrou_envoi);
+    actif = (sock->tampon_envoi != NULL);
+    if (actif){
+        attendre_acquittement(sock);
+        for (int i = 0; i < sock->capacite_tampon; i++){
+            free(sock->tampon_envoi[i].data);
+        }
+        free(sock->tampon_envoi);
+    }
+    sock->tampon_envoi = tampon;
+    sock->capacite_tampon = taille;
+    sock->tete_tampon = 0;
+    sock->queue_tampon = 0;
+    sock->envoye_tete = 0;
+    pthread_mutex_unlock(&sock->verrou_envoi);
+
+    if (actif != (tampon != NULL)){
+        inscrire_protocole(sock, tampon != NULL);
+    }
+    return 0;
+}
 
-                // création pdu ACK
-                mic_tcp_pdu ack;
-                ack.header.source_port = local_addr.port;
-                ack.header.dest_port = remote_addr.port;
-                ack.header.ack = 1;
-                ack.header.syn = 0;
-                ack.payload.size = 0;
-                ack.payload.data = NULL;
+/*
+ * Passe le socket en mode non bloquant (actif != 0) ou bloquant : en mode
+ * non bloquant, mic_tcp_send, mic_tcp_send_deadline, mic_tcp_flush,
+ * mic_tcp_recv et mic_tcp_accept retournent -1 avec errno = EAGAIN au lieu
+ * d'attendre ; mic_tcp_poll dit quand les rappeler
+ * Retourne 0 si tout se passe bien et -1 en cas d'erreur
+ */
+int mic_tcp_set_nonblocking(int socket, int actif)
+{
+    mic_tcp_sock* sock = get_socket(socket);
 
-                // envoyer ACK
-                if (IP_send(ack, addr.ip_addr) == -1){
-                    printf("erreur a envoyer ack\n");
-                } else {
-                    result = 0;
-                }
+    if (sock == NULL){
+        return -1;
+    }
+    sock->non_bloquant = actif;
+    return 0;
+}
 
-                // Continuer à écouter d'éventuels SYN-ACK dupliqués
-                int wait = 1;
-                int wait_count = 0;
-                while (wait && wait_count < 5) { // 5 tentatives max
-                    int again = IP_recv(&syn_ack, &local_ip, &remote_ip, TIMEOUT);
-                    if ((again != -1) && (syn_ack.header.ack == 1) && (syn_ack.header.syn == 1)) {
-                        // Renvoyer l'ACK si SYN-ACK dupliqué reçu
-                        if (IP_send(ack, addr.ip_addr) == -1){
-                            printf("erreur a renvoyer ack\n");
-                        }
-                        wait_count++;
-                    } else {
-                        wait = 0;
-                    }
-                }
-            } else {
-                // renvoyer SYN si pas reçu SYN_ACK
-                if (IP_send(syn, addr.ip_addr) == -1){
-                    printf("erreur a envoyer ack\n");
-                } 
+/*
+ * Événements prêts sur un socket parmi ceux demandés
+ */
+static short evenements_prets(mic_tcp_sock* sock, short events)
+{
+    short revents = 0;
+
+    if (events & POLLIN){
+        int pret = (app_ring_count(sock->reception) > 0);
+        if (!pret && sock->file_accept != NULL){
+            // socket en écoute : une connexion attend mic_tcp_accept
+            pthread_mutex_lock(&mutex);
+            for (mic_tcp_sock* c = sock->file_accept; c != NULL && !pret; c = c->suivant_accept){
+                pret = (c->state == ACK_RECEIVED);
             }
-        } 
-    } else {
-        result = -1;
-    } 
-
-    return result;
+            pthread_mutex_unlock(&mutex);
+        }
+        if (pret){
+            revents |= POLLIN;
+        }
+    }
+    if ((events & POLLOUT) && sock->state == CONNECTED){
+        // place dans le tampon d'envoi s'il y en a un, sinon dans la fenêtre
+        pthread_mutex_lock(&sock->verrou_envoi);
+        if ((sock->tampon_envoi != NULL) ? sock->queue_tampon - sock->tete_tampon < (unsigned int) sock->capacite_tampon
+                                         : sock->PE - sock->base_envoi < fenetre_effective(sock)){
+            revents |= POLLOUT;
+        }
+        pthread_mutex_unlock(&sock->verrou_envoi);
+    }
+    return revents;
 }
 
 /*
- * Permet de réclamer l’envoi d’une donnée applicative
- * Retourne la taille des données envoyées, et -1 en cas d'erreur
+ * Attend qu'un des nfds sockets soit prêt : POLLIN si mic_tcp_recv (ou
+ * mic_tcp_accept sur un socket en écoute) n'attendrait pas, POLLOUT si la
+ * fenêtre d'envoi a de la place ; timeout en msec, -1 pour attendre sans limite
+ * Le thread dort sur son eventfd, écrit par le thread de réception ou par
+ * le traitement des ACK, et côté client sur le socket UDP : pendant
+ * l'attente, il traite lui-même les ACK et les retransmissions des sockets
+ * surveillés
+ * Retourne le nombre de sockets prêts (0 à l'expiration du timeout) ou -1
  */
-int mic_tcp_send (int mic_sock, char* mesg, int mesg_size)
+int mic_tcp_poll(mic_tcp_pollfd* fds, int nfds, int timeout)
 {
-    int send = -1;
-    int control = 0;
-
-    printf("[MIC-TCP] Appel de la fonction: "); printf(__FUNCTION__); printf("\n");
-
-    // pdu ack
-    mic_tcp_pdu ack;
-    
-    // socket
-    mic_tcp_sock sock = sockets[mic_sock];
-    mic_tcp_sock_addr local_addr = sock.local_addr;
-    mic_tcp_sock_addr remote_addr = sock.remote_addr;
-
-    // pdu message
-    mic_tcp_pdu pdu;
+    int signale = 0;
+    int prets = 0;
+    int ip_fd = IP_recv_fd();
+    unsigned long fin = get_now_time_usec() + ((timeout > 0) ? timeout * 1000UL : 0);
+    mic_tcp_attente* maillons;
+    mic_tcp_sock** socks;
+
+    if (eventfd_attente == -1 && (eventfd_attente = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1){
+        return -1;
+    }
+    maillons = calloc(nfds, sizeof(mic_tcp_attente));
+    socks = calloc(nfds, sizeof(mic_tcp_sock*));
+    if (maillons == NULL || socks == NULL){
+        free(maillons);
+        free(socks);
+        return -1;
+    }
 
-    if (mic_sock == sock.fd){
-        // definir le pdu à envoyer  
-        pdu.header.dest_port = remote_addr.port;
-        pdu.header.source_port = local_addr.port;
-        pdu.header.seq_num = PE;
-        pdu.header.ack = 0;
-        pdu.header.syn = 0;
-        pdu.header.fin = 0;
+    // s'inscrire sur chaque socket avant de regarder son état : un
+    // changement ultérieur écrira l'eventfd
+    for (int i = 0; i < nfds; i++){
+        socks[i] = get_socket(fds[i].fd);
+        if (socks[i] == NULL){
+            continue;
+        }
+        maillons[i].eventfd = eventfd_attente;
+        maillons[i].signale = &signale;
+        pthread_mutex_lock(&socks[i]->verrou_attentes);
+        maillons[i].suivant = socks[i]->attentes;
+        __atomic_store_n(&socks[i]->attentes, &maillons[i], __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&socks[i]->verrou_attentes);
+    }
 
-        // mettre le message dans pdu
-        pdu.payload.size = mesg_size;
-        pdu.payload.data = mesg;
+    while (1){
+        uint64_t valeur;
+        long attente = -1;
+
+        // remis à zéro avant de regarder l'état des sockets, qu'un réveil
+        // arrivé entre-temps ne soit pas perdu
+        __atomic_store_n(&signale, 0, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (read(eventfd_attente, &valeur, sizeof(valeur)) > 0);
+
+        // côté client, aucun thread de réception ne lit les ACK ; pendant
+        // un mic_tcp_connect, repasser régulièrement sans lire le socket UDP
+        int lecture = (recuperer_acks() == 0);
+        if (ip_fd != -1 && !lecture){
+            attente = ATTENTE_POIGNEE / 1000;
+        }
 
-        //PE = (PE + 1) % 2; // incrementer PE
+        prets = 0;
+        for (int i = 0; i < nfds; i++){
+            mic_tcp_sock* sock = socks[i];
+            if (sock == NULL){
+                fds[i].revents = POLLNVAL;
+                prets++;
+                continue;
+            }
+            // les sockets à tampon d'envoi sont servis par le thread de protocole
+            if (ip_fd != -1 && sock->tampon_envoi == NULL && sock->PE != sock->base_envoi){
+                pthread_mutex_lock(&sock->verrou_envoi);
+                long delai = prochaine_expiration(sock);
+                if (delai == 0){
+                    traiter_expirations(sock);
+                    delai = prochaine_expiration(sock);
+                }
+                pthread_mutex_unlock(&sock->verrou_envoi);
+                if (delai >= 0 && (attente == -1 || delai < attente)){
+                    attente = delai;
+                }
+            }
+            fds[i].revents = evenements_prets(sock, fds[i].events);
+            if (fds[i].revents != 0){
+                prets++;
+            }
+        }
 
-        // envoyer le pdu a address remote ip
-        if ((send = IP_send(pdu, remote_addr.ip_addr)) == -1){
-            printf("error envoyer pdu\n");
-        } 
+        unsigned long now = get_now_time_usec();
+        if (prets > 0 || (timeout >= 0 && now >= fin)){
+            break;
+        }
 
-        // adresse ip de local et remote pour ack
-        mic_tcp_ip_addr local_addr_ip;
-        mic_tcp_ip_addr remote_addr_ip;
-
-        local_addr_ip.addr_size = IP_ADDR_MAX_LEN;
-        local_addr_ip.addr = malloc(IP_ADDR_MAX_LEN);
-        remote_addr_ip.addr_size = IP_ADDR_MAX_LEN;
-        remote_addr_ip.addr = malloc(IP_ADDR_MAX_LEN);
-
-        ack.payload.size = 0;
-
-        // controle de recuperation ack
-        while (control == 0){
-            // si on a bien reçu pdu ack qufloat) vient de remote addr
-            int ret = IP_recv(&ack, &local_addr_ip, &remote_addr_ip, TIMEOUT);
-            if ((ret != -1) && (ack.header.ack == 1) && (ack.header.syn == 0) && (ack.header.ack_num != PE)){
-                printf("ack bien reçu\n"); // affiche debug message
-                fenetre[indice_fenetre] = 1;  // success
-                indice_fenetre = (indice_fenetre + 1) % TAILLE_FENETRE;
-                PE = (PE + 1) % 2;
-                control = 1; // arreter boucle
-                 
-
-            } else if (ret == -1) { // expiration de timer
-
-                fenetre[indice_fenetre] = 0; // pas de success
-                
-                // Calcul nb perte
-                int pertes = 0;
-                for (int i = 0; i < TAILLE_FENETRE; i++){
-                    if (fenetre[i] == 0){
-                        pertes++;
-                    } 
-                } 
+        // dormir jusqu'au réveil, à l'arrivée d'un datagramme ou au prochain timer
+        if (timeout >= 0){
+            long reste = (long) ((fin - now + 999) / 1000);
+            if (attente == -1 || reste < attente){
+                attente = reste;
+            }
+        }
+        struct pollfd attendus[2] = { { eventfd_attente, POLLIN, 0 }, { ip_fd, POLLIN, 0 } };
+        poll(attendus, (ip_fd != -1 && lecture) ? 2 : 1, (int) attente);
+    }
 
-                //comparer le taux de perte avec PERTES_TOLERES
-                if (100*pertes/TAILLE_FENETRE <= perte_tolere){
-                    indice_fenetre = (indice_fenetre + 1) % TAILLE_FENETRE;
-                    control = 1;
+    for (int i = 0; i < nfds; i++){
+        if (socks[i] == NULL){
+            continue;
+        }
+        pthread_mutex_lock(&socks[i]->verrou_attentes);
+        mic_tcp_attente** p = &socks[i]->attentes;
+        while (*p != NULL && *p != &maillons[i]){
+            p = &(*p)->suivant;
+        }
+        if (*p != NULL){
+            *p = maillons[i].suivant;
+        }
+        pthread_mutex_unlock(&socks[i]->verrou_attentes);
+    }
+    free(maillons);
+    free(socks);
+    return prets;
+}
 
-                } else { // perte non tolere, renvoie pdu
+/*
+ * Permet à l'application de consulter l'estimation courante du RTT et le RTO
+ * Retourne 0 si succès, et -1 en cas d'erreur
+ */
+int mic_tcp_get_rtt_info(int socket, mic_tcp_rtt_info* info)
+{
+    mic_tcp_sock* sock = get_socket(socket);
 
-                    if ((send = IP_send(pdu, remote_addr.ip_addr)) == -1){
-                        printf("error envoyer pdu\n");
-                    } 
+    if (sock == NULL || info == NULL){
+        return -1;
+    }
+    // mis à jour par le traitement des ACK, sous le verrou d'envoi
+    pthread_mutex_lock(&sock->verrou_envoi);
+    *info = sock->rtt;
+    pthread_mutex_unlock(&sock->verrou_envoi);
+    return 0;
+}
 
-                } 
-            } 
-        } 
-    } else {
-        send = -1;
-    }  
+/*
+ * Copie les compteurs de la connexion, sans l'interrompre
+ * Retourne 0 si tout se passe bien et -1 en cas d'erreur
+ */
+int mic_tcp_get_stats(int socket, mic_tcp_stats* stats)
+{
+    mic_tcp_sock* sock = get_socket(socket);
 
-    return send;
-    
+    if (sock == NULL || stats == NULL){
+        return -1;
+    }
+    stats_read(sock->stats, stats);
+    return 0;
 }
 
 /*
  * Permet à l’application réceptrice de réclamer la récupération d’une donnée
  * stockée dans les buffers de réception du socket
  * Retourne le nombre d’octets lu ou bien -1 en cas d’erreur
- * NB : cette fonction fait appel à la fonction app_buffer_get()
+ * NB : cette fonction lit le buffer de réception propre au socket
  */
 int mic_tcp_recv (int socket, char* mesg, int max_mesg_size)
 {
-    printf("[MIC-TCP] Appel de la fonction: "); printf(__FUNCTION__); printf("\n");
+    LOG_DEBUG("[MIC-TCP] Appel de la fonction: %s\n", __FUNCTION__);
 
     int recv = -1;
-    mic_tcp_sock sock = sockets[socket];
+    mic_tcp_sock* sock = get_socket(socket);
 
     // message reçu
     mic_tcp_payload payload;
@@ -314,8 +2200,21 @@ int mic_tcp_recv (int socket, char* mesg, int max_mesg_size)
     payload.data = mesg;
 
     // recevoir le message
-    if (sock.fd == socket){
-        recv = app_buffer_get(payload); 
+    if (sock != NULL){
+        if (sock->non_bloquant && app_ring_count(sock->reception) == 0){
+            errno = EAGAIN;
+            return -1;
+        }
+        recv = app_ring_get(sock->reception, payload);
+        STAT_FIXER(sock, profondeur_buffer, app_ring_count(sock->reception));
+
+        // de la place s'est libérée pour les PDU déjà acquittés restés en attente
+        if (__atomic_load_n(&sock->livraison_bloquee, __ATOMIC_ACQUIRE)){
+            pthread_mutex_lock(&sock->verrou_reception);
+            sock->livraison_bloquee = 0;
+            sauter_jusqua(sock, sock->base_emetteur);
+            pthread_mutex_unlock(&sock->verrou_reception);
+        }
     } 
     return recv;
 }
@@ -327,120 +2226,352 @@ int mic_tcp_recv (int socket, char* mesg, int max_mesg_size)
  */
 int mic_tcp_close (int socket)
 {
-    printf("[MIC-TCP] Appel de la fonction :  "); printf(__FUNCTION__); printf("\n");
-    sockets[socket].state = CLOSED; 
+    LOG_DEBUG("[MIC-TCP] Appel de la fonction: %s\n", __FUNCTION__);
+
+    mic_tcp_sock* sock = get_socket(socket);
+
+    if (sock == NULL){
+        return -1;
+    }
+
+    // attendre l'acquittement (ou l'abandon) des PDU encore en vol
+    pthread_mutex_lock(&sock->verrou_envoi);
+    if (sock->state == CONNECTED){
+        attendre_acquittement(sock);
+    } else if (sock->PE != sock->base_envoi){
+        attendre_fenetre(sock, 0);
+    }
+    pthread_mutex_unlock(&sock->verrou_envoi);
+    if (sock->tampon_envoi != NULL){
+        mic_tcp_set_send_buffer(socket, 0);
+    }
+    // aucun PDU n'est plus en cours de traitement : un SYN ne peut plus
+    // ajouter de connexion à la file pendant qu'on la vide, et les
+    // connexions pas encore acceptées disparaissent avec le socket en écoute
+    pthread_rwlock_wrlock(&verrou_liberation);
+    pthread_mutex_lock(&mutex);
+    sock->state = CLOSED; 
+    sock->suivant_accept = sock->file_accept;
+    sock->file_accept = NULL;
+    pthread_mutex_unlock(&mutex);
+
+    // plus aucun PDU ne doit être démultiplexé vers ce socket, et son port est libéré
+    retirer_sockets(sock);
+    if (sock->ecoute == NULL){
+        // une connexion acceptée partage le port de son socket en écoute
+        pthread_rwlock_wrlock(&verrou_tables);
+        ports_utilises[sock->local_addr.port / 8] &= ~(1 << (sock->local_addr.port % 8));
+        pthread_rwlock_unlock(&verrou_tables);
+    }
+    pthread_rwlock_unlock(&verrou_liberation);
+
+    while (sock != NULL){
+        mic_tcp_sock* suivant = sock->suivant_accept;
+        detruire_socket(sock);
+        sock = suivant;
+    }
     return 0;
 }
 
+/*
+ * Fenêtre annoncée dans les ACK : places libres dans le buffer applicatif,
+ * au plus la taille du buffer de réordonnancement
+ */
+static unsigned short fenetre_annoncee(mic_tcp_sock* sock)
+{
+    int libres = app_ring_free(sock->reception);
+    return (libres < TAILLE_FENETRE_ENVOI_MAX) ? libres : TAILLE_FENETRE_ENVOI_MAX;
+}
+
+/*
+ * Traitement d'un PDU de données ou de parité : livraison (ou mise en attente)
+ * des données, réparation par la FEC, puis acquittements
+ * Appelée sous le verrou de réception du socket
+ */
+static void traiter_donnees(mic_tcp_sock* sock, mic_tcp_pdu pdu)
+{
+    mic_tcp_pdu ack;
+    unsigned int seq = pdu.header.seq_num;
+    fec_repare repares[FEC_M_MAX];
+    int nb_repares = 0;
+
+    TRACE(TRACE_PDU_RECV, seq, pdu.header.ack_num, pdu.payload.size);
+    STAT_AJOUTER(sock, pdu_recus, 1);
+    STAT_AJOUTER(sock, octets_recus, pdu.payload.size);
+
+    if (pdu.header.fec != 0 && sock->fec.mode == FEC_AUCUN){
+        // parité d'un pair qui n'a pas suivi la négociation : ni livrée
+        // comme donnée, ni acquittée
+        STAT_AJOUTER(sock, parites_ignorees, 1);
+        return;
+    }
+
+    // l'émetteur ne retransmettra plus les PDU précédant ack_num
+    if (seq_inf(sock->base_emetteur, pdu.header.ack_num)){
+        sock->base_emetteur = pdu.header.ack_num;
+    }
+    sauter_jusqua(sock, sock->base_emetteur);
+
+    if (pdu.header.fec != 0){
+        // PDU de parité : seq_num est le premier PDU de son groupe
+        nb_repares = mic_tcp_fec_parite(&sock->fec, seq, pdu.header.fec - 1, pdu.payload.data, pdu.payload.size, repares);
+    } else {
+        if (recevoir_donnees(sock, seq, pdu.payload, pdu.header.segment) == -1){
+            return;
+        }
+        if (sock->fec.mode != FEC_AUCUN){
+            nb_repares = mic_tcp_fec_donnee(&sock->fec, seq, pdu.payload.data, pdu.payload.size, pdu.header.segment, repares);
+        }
+    }
+
+    // création ACK
+    memset(&ack, 0, sizeof(ack));
+    ack.header.source_port = pdu.header.dest_port;
+    ack.header.dest_port = pdu.header.source_port;
+    ack.header.ack = 1;
+    ack.header.syn = 0;
+    ack.header.fec = 0;
+    ack.header.segment = 0;
+    ack.header.taille_options = 0;
+    ack.payload.size = 0;
+    ack.payload.data = NULL;
+
+    // un ACK par PDU reçu ou reconstruit, envoyés ensemble par le thread de réception
+    for (int i = -1; i < nb_repares; i++){
+        unsigned int acquitte = seq;
+        if (i >= 0){
+            mic_tcp_payload payload = { repares[i].data, repares[i].size };
+            TRACE(TRACE_FEC_REPAIR, repares[i].seq, seq, repares[i].size);
+            STAT_AJOUTER(sock, reparations, 1);
+            if (recevoir_donnees(sock, repares[i].seq, payload, repares[i].segment) == -1){
+                continue;
+            }
+            acquitte = repares[i].seq;
+        } else if (pdu.header.fec != 0){
+            continue; // une parité n'est pas acquittée
+        }
+        ack.header.seq_num = sock->PA;  // acquittement cumulatif
+        ack.header.ack_num = acquitte; // acquittement sélectif
+        ack.header.rwnd = fenetre_annoncee(sock);
+        if (IP_send_resolved(ack, &sock->remote_sockaddr) == -1){
+            LOG_ERROR("erreur a envoyer ack\n");
+        }
+        STAT_AJOUTER(sock, acks_envoyes, 1);
+    }
+    STAT_FIXER(sock, profondeur_buffer, app_ring_count(sock->reception));
+    if (app_ring_count(sock->reception) > 0){
+        reveiller(sock);
+    }
+}
+
+/*
+ * Retire de la file d'un socket en écoute les poignées de main restées
+ * sans ACK plus de DELAI_POIGNEE, chaînées dans *expirees (mutex pris)
+ */
+static void expirer_poignees(mic_tcp_sock* ecoute, unsigned long now, mic_tcp_sock** expirees)
+{
+    mic_tcp_sock** p = &ecoute->file_accept;
+
+    while (*p != NULL){
+        mic_tcp_sock* c = *p;
+        if (c->state == WAIT_ACK && now - c->date_syn > DELAI_POIGNEE){
+            *p = c->suivant_accept;
+            c->suivant_accept = *expirees;
+            *expirees = c;
+            ecoute->taille_file_accept--;
+        } else {
+            p = &c->suivant_accept;
+        }
+    }
+}
+
 /*
  * Traitement d’un PDU MIC-TCP reçu (mise à jour des numéros de séquence
  * et d'acquittement, etc.) puis insère les données utiles du PDU dans
- * le buffer de réception du socket. Cette fonction utilise la fonction
- * app_buffer_put().
+ * le buffer de réception du socket, retrouvé à partir des ports et de
+ * l'adresse source du PDU. Les poignées de main expirées sont chaînées
+ * dans *expirees, à libérer une fois verrou_liberation relâché
  */
-void process_received_PDU(mic_tcp_pdu pdu, mic_tcp_ip_addr local_addr, mic_tcp_ip_addr remote_addr)
+static void traiter_pdu(mic_tcp_pdu pdu, mic_tcp_ip_addr remote_addr, mic_tcp_sock** expirees)
 {
-    printf("[MIC-TCP] Appel de la fonction: "); printf(__FUNCTION__); printf("\n");
-
-    int client_loss_rate;
+    mic_tcp_negociation proposition;
     int server_loss_rate = SERVER_LOSS_RATE;
-    int final_loss_rate;
+
+    // adresse du pair, prise sur le datagramme reçu
+    struct sockaddr_in remote_sockaddr;
+    if (IP_source(&remote_sockaddr) == -1 && IP_resolve(remote_addr, &remote_sockaddr) == -1){
+        LOG_ERROR("erreur resolution adresse\n");
+        return;
+    }
+
+    // socket destinataire : la connexion établie, sinon un socket en écoute
+    mic_tcp_sock* sock = chercher_socket(pdu.header.dest_port, pdu.header.source_port, &remote_sockaddr);
+
+    if (sock == NULL){
+        return;
+    }
 
     // vérifier si pdu reçu est SYN pendant la connexion
     if ((pdu.header.syn == 1) && (pdu.header.ack == 0)){
 
-        // récuperer numéro de socket
-        int sock = -1;
-        for (int i = 0; i < MAX_SOCKET; i++){
-            if (sockets[i].local_addr.port == pdu.header.dest_port){
-                sock = i;
-                break;
-            } 
-        } 
+        if (sock->remote_addr.port == 0){
+            // SYN sur un socket en écoute : nouvelle connexion, s'il reste
+            // de la place dans sa file une fois les poignées de main
+            // expirées retirées
+            mic_tcp_sock* ecoute = sock;
+            unsigned long now = get_now_time_usec();
+
+            pthread_mutex_lock(&mutex);
+            expirer_poignees(ecoute, now, expirees);
+            int place = (ecoute->taille_file_accept < FILE_ACCEPT_MAX);
+            if (place){
+                ecoute->taille_file_accept++;
+            }
+            pthread_mutex_unlock(&mutex);
+            if (*expirees != NULL){
+                retirer_sockets(*expirees);
+            }
+            if (!place){
+                LOG_DEBUG("file d'accept pleine, SYN ignore\n");
+                return;
+            }
 
-        if (sock != -1){
-            // store adresse ip de client
-            sockets[sock].remote_addr.ip_addr = remote_addr; 
-
-            // creation pdu syn_ack
-            mic_tcp_pdu syn_ack;
-            syn_ack.header.dest_port = pdu.header.source_port;
-            syn_ack.header.source_port = pdu.header.dest_port;
-            syn_ack.header.ack = 1;
-            syn_ack.header.syn = 1;
-            syn_ack.payload.size = 0;
-            syn_ack.payload.data = NULL;
-                
-            // envoyer SYN_ACK
-            if ((IP_send(syn_ack,remote_addr)) == -1){
-                printf("error envoyer pdu\n");
-            } 
-
-            // changement de l'état à WAIT_ACK
-            sockets[sock].state = WAIT_ACK; 
-
-            // récuperer loss_rate de client que SYN a apporté
-            memcpy(&client_loss_rate, pdu.payload.data, sizeof(int));
-            
-            // comparaison des loss_rate et choisir final_loss_rate
-            if (client_loss_rate <= server_loss_rate){
-                final_loss_rate = client_loss_rate;
+            sock = creer_socket();
+            sock->local_addr = ecoute->local_addr;
+            sock->remote_addr.port = pdu.header.source_port;
+            inet_ntop(AF_INET, &remote_sockaddr.sin_addr, sock->ip_distante, sizeof(sock->ip_distante));
+            sock->remote_addr.ip_addr.addr = sock->ip_distante;
+            sock->remote_addr.ip_addr.addr_size = strlen(sock->ip_distante) + 1;
+            sock->remote_sockaddr = remote_sockaddr;
+            sock->ecoute = ecoute;
+            sock->date_syn = now;
+            sock->state = WAIT_ACK;
+
+            // récuperer loss_rate et FEC de client que SYN a apporté (un ancien client n'envoie que loss_rate)
+            memset(&proposition, 0, sizeof(proposition));
+            if (pdu.payload.size >= (int) sizeof(int)){
+                int taille = (pdu.payload.size < (int) sizeof(proposition)) ? pdu.payload.size : (int) sizeof(proposition);
+                memcpy(&proposition, pdu.payload.data, taille);
+            }
+
+            // comparaison des loss_rate et choisir final_loss_rate, mis comme perte tolere
+            if (proposition.loss_rate <= server_loss_rate){
+                sock->perte_tolere = proposition.loss_rate;
             } else {
-                final_loss_rate = server_loss_rate;
+                sock->perte_tolere = server_loss_rate;
             }
-            
-            // mettre le choix final comme perte tolere
-            perte_tolere = final_loss_rate;
-        } 
 
-        
+            // accepter la FEC demandée en limitant sa redondance
+            int m = proposition.fec_m;
+            if (100 * m > SERVER_FEC_RATIO * proposition.fec_k){
+                m = SERVER_FEC_RATIO * proposition.fec_k / 100;
+            }
+            if (m < 1){
+                m = 1;
+            }
+            if (mic_tcp_fec_init(&sock->fec, proposition.fec, proposition.fec_k, m) == -1){
+                mic_tcp_fec_init(&sock->fec, FEC_AUCUN, 0, 0);
+            }
+
+            // paramètres retenus, renvoyés à l'identique si le SYN est dupliqué
+            sock->negociation.loss_rate = sock->perte_tolere;
+            sock->negociation.fec = sock->fec.mode;
+            sock->negociation.fec_k = sock->fec.k;
+            sock->negociation.fec_m = sock->fec.m;
+
+            pthread_rwlock_wrlock(&verrou_tables);
+            inserer_hash(sock);
+            pthread_rwlock_unlock(&verrou_tables);
+
+            // la connexion attend mic_tcp_accept en queue de la file du socket en écoute
+            pthread_mutex_lock(&mutex);
+            mic_tcp_sock** fin = &ecoute->file_accept;
+            while (*fin != NULL){
+                fin = &(*fin)->suivant_accept;
+            }
+            sock->suivant_accept = NULL;
+            *fin = sock;
+            pthread_mutex_unlock(&mutex);
+        }
+
+        // creation pdu syn_ack, qui porte les paramètres retenus
+        mic_tcp_pdu syn_ack;
+        memset(&syn_ack, 0, sizeof(syn_ack));
+        syn_ack.header.dest_port = pdu.header.source_port;
+        syn_ack.header.source_port = pdu.header.dest_port;
+        syn_ack.header.ack = 1;
+        syn_ack.header.syn = 1;
+        syn_ack.header.fec = 0;
+        syn_ack.header.segment = 0;
+        syn_ack.header.rwnd = TAILLE_FENETRE_ENVOI_MAX;
+        syn_ack.header.taille_options = 0;
+        // la charge utile doit survivre jusqu'à l'envoi groupé du thread de réception
+        mic_tcp_negociation* negociation = &negociations_envoyees[prochaine_negociation++ % (SEND_BATCH_SIZE + 1)];
+        *negociation = sock->negociation;
+        syn_ack.payload.size = sizeof(mic_tcp_negociation);
+        syn_ack.payload.data = (char*) negociation;
             
+        // envoyer SYN_ACK
+        if ((IP_send_resolved(syn_ack, &sock->remote_sockaddr)) == -1){
+            LOG_ERROR("error envoyer pdu\n");
+        } 
     }
 
     // vérifier si pdu reçu est ACK pendant la connexion
     else if ((pdu.header.syn == 0) && (pdu.header.ack == 1)){
         
-        printf("ack recieved\n");
-        // récuperer numéro de socket
-        int sock = -1;
-        for (int i = 0; i < MAX_SOCKET; i++){
-            if (sockets[i].local_addr.port == pdu.header.dest_port){
-                sock = i;
-                break;
-            }
-        }
+        LOG_DEBUG("ack recieved\n");
 
         // changer l'état à ACK_RECEIVED
-        if (sock != -1){
-            sockets[sock].state = ACK_RECEIVED;
+        pthread_mutex_lock(&mutex);
+        if (sock->state == WAIT_ACK){
+            sock->state = ACK_RECEIVED;
 
             // signaler mutex en attente
             pthread_cond_broadcast(&cond);
         } 
+        pthread_mutex_unlock(&mutex);
+        if (sock->state == ACK_RECEIVED && sock->ecoute != NULL){
+            reveiller(sock->ecoute);
+        }
     } 
     
     // cas message PDU
     else if ((pdu.header.syn == 0) && (pdu.header.ack == 0)){  
 
-        mic_tcp_pdu ack;
+        if (sock->remote_addr.port == 0){
+            return; // pas de connexion sur ce socket
+        }
 
-        if (pdu.header.seq_num == PA){
-            app_buffer_put(pdu.payload);
-            PA = (PA + 1) % 2; 
-        } 
+        if (sock->state == WAIT_ACK){
+            // l'ACK de la poignée de main a été perdu, les données le remplacent
+            pthread_mutex_lock(&mutex);
+            sock->state = ACK_RECEIVED;
+            pthread_cond_broadcast(&cond);
+            pthread_mutex_unlock(&mutex);
+            if (sock->ecoute != NULL){
+                reveiller(sock->ecoute);
+            }
+        }
 
-        // création ACK
-        ack.header.source_port = pdu.header.dest_port;
-        ack.header.dest_port = pdu.header.source_port;
-        ack.header.ack_num = PA;
-        ack.header.ack = 1;
-        ack.header.syn = 0;
-        ack.payload.size = 0;
-        ack.payload.data = NULL;
-
-        // envoyer ACK
-        if (IP_send(ack, remote_addr) == -1){
-            printf("erreur a envoyer ack\n");
-        } 
+        // l'application peut relancer la livraison depuis mic_tcp_recv
+        pthread_mutex_lock(&sock->verrou_reception);
+        traiter_donnees(sock, pdu);
+        pthread_mutex_unlock(&sock->verrou_reception);
     } 
-}
\ No newline at end of file
+}
+
+/*
+ * Point d'entrée des threads de réception, voir traiter_pdu
+ */
+void process_received_PDU(mic_tcp_pdu pdu, mic_tcp_ip_addr local_addr, mic_tcp_ip_addr remote_addr)
+{
+    LOG_DEBUG("[MIC-TCP] Appel de la fonction: %s\n", __FUNCTION__);
+
+    mic_tcp_sock* expirees = NULL;
+
+    pthread_rwlock_rdlock(&verrou_liberation);
+    traiter_pdu(pdu, remote_addr, &expirees);
+    pthread_rwlock_unlock(&verrou_liberation);
+    liberer_sockets(expirees);
+}
@@ -0,0 +1,253 @@
+#include <mictcp_cc.h>
+#include <math.h>
+#include <string.h>
+
+#define RENO_BETA 0.5    // facteur de réduction de Reno
+#define CUBIC_BETA 0.7   // facteur de réduction de CUBIC (RFC 8312)
+#define CUBIC_C 0.4      // agressivité de la fonction cubique (RFC 8312)
+
+/*
+ * Compare deux numéros de séquence en tenant compte du rebouclage
+ */
+static int seq_avant(unsigned int a, unsigned int b)
+{
+    return (int)(a - b) < 0;
+}
+
+/*
+ * Slow start commun à Reno et CUBIC : +1 PDU par PDU acquitté
+ * Retourne le nombre d'acquittements restant pour l'évitement de congestion
+ */
+static unsigned int slow_start(mic_tcp_cc* cc, unsigned int nb_acquittes)
+{
+    while (nb_acquittes > 0 && cc->cwnd < cc->ssthresh){
+        cc->cwnd += 1;
+        nb_acquittes--;
+    }
+    return nb_acquittes;
+}
+
+static unsigned int cwnd_entiere(mic_tcp_cc* cc)
+{
+    return (cc->cwnd < CC_CWND_MIN) ? CC_CWND_MIN : (unsigned int) cc->cwnd;
+}
+
+/*
+ * Reno (RFC 5681) : croissance additive d'un PDU par RTT, division par deux sur perte
+ */
+static void reno_init(mic_tcp_cc* cc)
+{
+    cc->cwnd = CC_CWND_INITIAL;
+    cc->ssthresh = HUGE_VAL;
+}
+
+static void reno_on_ack(mic_tcp_cc* cc, unsigned int nb_acquittes, unsigned long rtt, unsigned long now)
+{
+    nb_acquittes = slow_start(cc, nb_acquittes);
+    cc->cwnd += (double) nb_acquittes / cc->cwnd;
+}
+
+static void reno_on_loss(mic_tcp_cc* cc, unsigned long now)
+{
+    cc->ssthresh = fmax(cc->cwnd * RENO_BETA, 2);
+    cc->cwnd = cc->ssthresh;
+}
+
+static void reno_on_rto(mic_tcp_cc* cc, unsigned long now)
+{
+    cc->ssthresh = fmax(cc->cwnd * RENO_BETA, 2);
+    cc->cwnd = CC_CWND_MIN;
+}
+
+const mic_tcp_cc_ops cc_reno = {
+    .nom = "reno",
+    .init = reno_init,
+    .on_ack = reno_on_ack,
+    .on_loss = reno_on_loss,
+    .on_rto = reno_on_rto,
+    .cwnd = cwnd_entiere,
+    .pacing = NULL,
+};
+
+/*
+ * CUBIC (RFC 8312) : après une réduction, la fenêtre suit
+ * W(t) = C (t - K)^3 + w_max, sans jamais croître moins vite que Reno
+ */
+static void cubic_init(mic_tcp_cc* cc)
+{
+    reno_init(cc);
+    cc->w_max = 0;
+    cc->k = 0;
+    cc->debut_epoque = 0;
+}
+
+static void cubic_on_ack(mic_tcp_cc* cc, unsigned int nb_acquittes, unsigned long rtt, unsigned long now)
+{
+    nb_acquittes = slow_start(cc, nb_acquittes);
+    if (nb_acquittes == 0){
+        return;
+    }
+
+    if (cc->debut_epoque == 0){
+        // début d'une phase d'évitement de congestion
+        cc->debut_epoque = now;
+        if (cc->cwnd < cc->w_max){
+            cc->k = cbrt((cc->w_max - cc->cwnd) / CUBIC_C);
+        } else {
+            cc->k = 0;
+            cc->w_max = cc->cwnd;
+        }
+        cc->w_est = cc->cwnd;
+    }
+
+    // fenêtre visée un RTT plus tard
+    double t = (double)(now - cc->debut_epoque + rtt) / 1e6;
+    double cible = CUBIC_C * pow(t - cc->k, 3) + cc->w_max;
+
+    // région TCP-friendly : fenêtre qu'aurait obtenue Reno sur la même durée
+    cc->w_est += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * nb_acquittes / cc->cwnd;
+    if (cible < cc->w_est){
+        cible = cc->w_est;
+    }
+
+    if (cible > cc->cwnd){
+        cc->cwnd += (cible - cc->cwnd) * nb_acquittes / cc->cwnd;
+    } else {
+        cc->cwnd += 0.01 * nb_acquittes / cc->cwnd;
+    }
+}
+
+static void cubic_on_loss(mic_tcp_cc* cc, unsigned long now)
+{
+    cc->w_max = cc->cwnd;
+    cc->ssthresh = fmax(cc->cwnd * CUBIC_BETA, 2);
+    cc->cwnd = cc->ssthresh;
+    cc->debut_epoque = 0;
+}
+
+static void cubic_on_rto(mic_tcp_cc* cc, unsigned long now)
+{
+    cubic_on_loss(cc, now);
+    cc->cwnd = CC_CWND_MIN;
+}
+
+const mic_tcp_cc_ops cc_cubic = {
+    .nom = "cubic",
+    .init = cubic_init,
+    .on_ack = cubic_on_ack,
+    .on_loss = cubic_on_loss,
+    .on_rto = cubic_on_rto,
+    .cwnd = cwnd_entiere,
+    .pacing = NULL,
+};
+
+/*
+ * Fenêtre fixe : aucun contrôle de congestion, seule la fenêtre d'envoi
+ * réglée par mic_tcp_set_send_window limite les PDU en vol
+ */
+static void fixe_init(mic_tcp_cc* cc)
+{
+    cc->cwnd = HUGE_VAL;
+    cc->ssthresh = HUGE_VAL;
+}
+
+static void fixe_evenement(mic_tcp_cc* cc, unsigned long now)
+{
+}
+
+static void fixe_on_ack(mic_tcp_cc* cc, unsigned int nb_acquittes, unsigned long rtt, unsigned long now)
+{
+}
+
+static unsigned int fixe_cwnd(mic_tcp_cc* cc)
+{
+    return (unsigned int) -1;
+}
+
+const mic_tcp_cc_ops cc_fixe = {
+    .nom = "fixe",
+    .init = fixe_init,
+    .on_ack = fixe_on_ack,
+    .on_loss = fixe_evenement,
+    .on_rto = fixe_evenement,
+    .cwnd = fixe_cwnd,
+    .pacing = NULL,
+};
+
+static const mic_tcp_cc_ops* modules[] = { &cc_reno, &cc_cubic, &cc_fixe, NULL };
+
+/*
+ * Retourne le module de contrôle de congestion de nom donné, NULL s'il n'existe pas
+ */
+const mic_tcp_cc_ops* mic_tcp_cc_trouver(const char* nom)
+{
+    for (int i = 0; nom != NULL && modules[i] != NULL; i++){
+        if (strcmp(modules[i]->nom, nom) == 0){
+            return modules[i];
+        }
+    }
+    return NULL;
+}
+
+void mic_tcp_cc_init(mic_tcp_cc* cc, const mic_tcp_cc_ops* ops)
+{
+    memset(cc, 0, sizeof(mic_tcp_cc));
+    cc->ops = ops;
+    ops->init(cc);
+}
+
+/*
+ * Acquittement de nouveaux PDU ; la fenêtre ne grandit pas pendant la
+ * récupération d'une perte, qui se termine quand tous les PDU en vol au
+ * moment de la perte ont été acquittés ou abandonnés
+ */
+void mic_tcp_cc_ack(mic_tcp_cc* cc, unsigned int nb_acquittes, unsigned int base_envoi, unsigned long rtt, unsigned long now)
+{
+    if (cc->en_recuperation && !seq_avant(base_envoi, cc->fin_recuperation)){
+        cc->en_recuperation = 0;
+    }
+    if (!cc->en_recuperation && nb_acquittes > 0){
+        cc->ops->on_ack(cc, nb_acquittes, rtt, now);
+    }
+}
+
+/*
+ * Perte du PDU seq, détectée par les acquittements sélectifs ; une seule
+ * réduction par fenêtre de PDU
+ */
+void mic_tcp_cc_perte(mic_tcp_cc* cc, unsigned int seq, unsigned int PE, unsigned long now)
+{
+    if (cc->en_recuperation && seq_avant(seq, cc->fin_recuperation)){
+        return;
+    }
+    cc->en_recuperation = 1;
+    cc->fin_recuperation = PE;
+    cc->ops->on_loss(cc, now);
+}
+
+/*
+ * Expiration du timer de retransmission, signalée une fois par passe quel
+ * que soit le nombre de PDU expirés ; date_envoi est l'envoi le plus récent
+ * parmi eux. Les PDU envoyés avant la dernière expiration traitée relèvent
+ * du même évènement ; sinon, la récupération repart de PE
+ */
+void mic_tcp_cc_expiration(mic_tcp_cc* cc, unsigned long date_envoi, unsigned int PE, unsigned long now)
+{
+    if (date_envoi < cc->date_expiration){
+        return;
+    }
+    cc->date_expiration = now;
+    cc->en_recuperation = 1;
+    cc->fin_recuperation = PE;
+    cc->ops->on_rto(cc, now);
+}
+
+unsigned int mic_tcp_cc_fenetre(mic_tcp_cc* cc)
+{
+    return cc->ops->cwnd(cc);
+}
+
+unsigned long mic_tcp_cc_pacing(mic_tcp_cc* cc, unsigned long rtt)
+{
+    return (cc->ops->pacing != NULL) ? cc->ops->pacing(cc, rtt) : 0;
+}
@@ -0,0 +1,406 @@
+#include <mictcp_fec.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define FEC_SSSE3 1
+#endif
+
+#define GF_POLYNOME 0x11d    // polynôme primitif de GF(256)
+#define FEC_PDU_SUIVIS 128   // PDU récents dont le récepteur garde les symboles (deux fenêtres d'envoi)
+
+static unsigned char gf_exp[510];
+static unsigned char gf_log[256];
+static pthread_once_t gf_once = PTHREAD_ONCE_INIT;
+
+/*
+ * dst ^= c * src sur len octets, version choisie à l'initialisation
+ */
+static void (*gf_region)(unsigned char* dst, const unsigned char* src, unsigned char c, int len);
+
+/*
+ * Compare deux numéros de séquence en tenant compte du rebouclage
+ */
+static int seq_avant(unsigned int a, unsigned int b)
+{
+    return (int)(a - b) < 0;
+}
+
+static unsigned char gf_mul(unsigned char a, unsigned char b)
+{
+    if (a == 0 || b == 0){
+        return 0;
+    }
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static unsigned char gf_inv(unsigned char a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+static void gf_region_scalaire(unsigned char* dst, const unsigned char* src, unsigned char c, int len)
+{
+    if (c == 0){
+        return;
+    }
+    if (c == 1){
+        for (int i = 0; i < len; i++){
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+    const unsigned char* exp_c = &gf_exp[gf_log[c]];
+    for (int i = 0; i < len; i++){
+        if (src[i] != 0){
+            dst[i] ^= exp_c[gf_log[src[i]]];
+        }
+    }
+}
+
+#ifdef FEC_SSSE3
+/*
+ * Multiplication par une constante avec pshufb : c * x = c * (x & 0x0f) ^ c * (x & 0xf0),
+ * chacun des deux termes étant lu dans une table de 16 octets
+ */
+__attribute__((target("ssse3")))
+static void gf_region_ssse3(unsigned char* dst, const unsigned char* src, unsigned char c, int len)
+{
+    unsigned char bas[16], haut[16];
+    int i = 0;
+
+    if (c == 0){
+        return;
+    }
+    for (int x = 0; x < 16; x++){
+        bas[x] = gf_mul(c, x);
+        haut[x] = gf_mul(c, x << 4);
+    }
+
+    __m128i t_bas = _mm_loadu_si128((const __m128i *) bas);
+    __m128i t_haut = _mm_loadu_si128((const __m128i *) haut);
+    __m128i masque = _mm_set1_epi8(0x0f);
+
+    for (; i + 16 <= len; i += 16){
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i p_bas = _mm_shuffle_epi8(t_bas, _mm_and_si128(s, masque));
+        __m128i p_haut = _mm_shuffle_epi8(t_haut, _mm_and_si128(_mm_srli_epi64(s, 4), masque));
+        d = _mm_xor_si128(d, _mm_xor_si128(p_bas, p_haut));
+        _mm_storeu_si128((__m128i *) (dst + i), d);
+    }
+    gf_region_scalaire(dst + i, src + i, c, len - i);
+}
+#endif
+
+static void gf_init(void)
+{
+    unsigned int x = 1;
+
+    for (int i = 0; i < 255; i++){
+        gf_exp[i] = x;
+        gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100){
+            x ^= GF_POLYNOME;
+        }
+    }
+
+    gf_region = gf_region_scalaire;
+#ifdef FEC_SSSE3
+    if (__builtin_cpu_supports("ssse3")){
+        gf_region = gf_region_ssse3;
+    }
+#endif
+}
+
+/*
+ * Coefficient du symbole de données i dans la parité j
+ */
+static unsigned char coefficient(mic_tcp_fec* fec, int j, int i)
+{
+    if (fec->mode == FEC_XOR){
+        return 1;
+    }
+    // matrice de Cauchy 1 / (x_j + y_i) avec x_j = k + j et y_i = i, tous distincts
+    return gf_inv((unsigned char)((fec->k + j) ^ i));
+}
+
+/*
+ * dst ^= c * symbole du message (data, size), taille et drapeaux compris
+ */
+static void ajouter_symbole(unsigned char* dst, unsigned char c, const char* data, int size, unsigned char segment)
+{
+    int entete = size | (segment << 13);
+
+    dst[0] ^= gf_mul(c, entete & 0xff);
+    dst[1] ^= gf_mul(c, entete >> 8);
+    gf_region(dst + 2, (const unsigned char *) data, c, size);
+}
+
+static void reserver(unsigned char** buffer, int* capacite, int taille)
+{
+    if (taille > *capacite){
+        *buffer = realloc(*buffer, taille);
+        *capacite = taille;
+    }
+}
+
+int mic_tcp_fec_init(mic_tcp_fec* fec, int mode, int k, int m)
+{
+    pthread_once(&gf_once, gf_init);
+    mic_tcp_fec_liberer(fec);
+
+    if (mode == FEC_AUCUN){
+        return 0;
+    }
+    if (mode == FEC_XOR){
+        m = 1;
+    }
+    if ((mode != FEC_XOR && mode != FEC_RS) || k < 1 || k > FEC_K_MAX || m < 1 || m > FEC_M_MAX){
+        return -1;
+    }
+
+    fec->nb_groupes = FEC_PDU_SUIVIS / k + 2;
+    fec->groupes = calloc(fec->nb_groupes, sizeof(fec_groupe));
+    if (fec->groupes == NULL){
+        return -1;
+    }
+    fec->mode = mode;
+    fec->k = k;
+    fec->m = m;
+    return 0;
+}
+
+void mic_tcp_fec_liberer(mic_tcp_fec* fec)
+{
+    for (int j = 0; j < FEC_M_MAX; j++){
+        free(fec->parite[j]);
+    }
+    for (int g = 0; g < fec->nb_groupes; g++){
+        for (int i = 0; i < FEC_K_MAX + FEC_M_MAX; i++){
+            free(fec->groupes[g].symbole[i]);
+        }
+    }
+    free(fec->groupes);
+    memset(fec, 0, sizeof(mic_tcp_fec));
+}
+
+void mic_tcp_fec_encoder(mic_tcp_fec* fec, char** data, const int* tailles, const unsigned char* segments)
+{
+    int taille = 0;
+
+    for (int i = 0; i < fec->k; i++){
+        if (tailles[i] > taille){
+            taille = tailles[i];
+        }
+    }
+    taille += 2;
+
+    for (int j = 0; j < fec->m; j++){
+        reserver(&fec->parite[j], &fec->capacite_parite[j], taille);
+        memset(fec->parite[j], 0, taille);
+        for (int i = 0; i < fec->k; i++){
+            ajouter_symbole(fec->parite[j], coefficient(fec, j, i), data[i], tailles[i], segments[i]);
+        }
+    }
+    fec->taille_parite = taille;
+}
+
+/*
+ * Retourne le groupe commençant à base, en recyclant l'emplacement d'un
+ * groupe plus ancien ; NULL si le groupe est trop ancien pour être suivi
+ */
+static fec_groupe* trouver_groupe(mic_tcp_fec* fec, unsigned int base)
+{
+    fec_groupe* g = &fec->groupes[(base / fec->k) % fec->nb_groupes];
+
+    if (g->actif && g->base == base){
+        return g;
+    }
+    if (g->actif && seq_avant(base, g->base)){
+        return NULL;
+    }
+    g->actif = 1;
+    g->base = base;
+    g->repare = 0;
+    memset(g->recu, 0, sizeof(g->recu));
+    return g;
+}
+
+/*
+ * Inverse une matrice e x e sur GF(256) (Gauss-Jordan)
+ * Retourne 0 si succès, -1 si la matrice n'est pas inversible
+ */
+static int inverser(unsigned char a[FEC_M_MAX][FEC_M_MAX], unsigned char inv[FEC_M_MAX][FEC_M_MAX], int e)
+{
+    for (int r = 0; r < e; r++){
+        for (int c = 0; c < e; c++){
+            inv[r][c] = (r == c);
+        }
+    }
+
+    for (int c = 0; c < e; c++){
+        int pivot = c;
+        while (pivot < e && a[pivot][c] == 0){
+            pivot++;
+        }
+        if (pivot == e){
+            return -1;
+        }
+        for (int x = 0; x < e; x++){
+            unsigned char t = a[c][x]; a[c][x] = a[pivot][x]; a[pivot][x] = t;
+            t = inv[c][x]; inv[c][x] = inv[pivot][x]; inv[pivot][x] = t;
+        }
+
+        unsigned char facteur = gf_inv(a[c][c]);
+        for (int x = 0; x < e; x++){
+            a[c][x] = gf_mul(a[c][x], facteur);
+            inv[c][x] = gf_mul(inv[c][x], facteur);
+        }
+
+        for (int r = 0; r < e; r++){
+            unsigned char f = a[r][c];
+            if (r == c || f == 0){
+                continue;
+            }
+            for (int x = 0; x < e; x++){
+                a[r][x] ^= gf_mul(f, a[c][x]);
+                inv[r][x] ^= gf_mul(f, inv[c][x]);
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Reconstruit les symboles de données manquants d'un groupe si assez de
+ * parités sont arrivées
+ * Retourne le nombre de PDU reconstruits
+ */
+static int reparer(mic_tcp_fec* fec, fec_groupe* g, fec_repare* repares)
+{
+    int manquants[FEC_M_MAX];
+    int parites[FEC_M_MAX];
+    int e = 0;
+    int p = 0;
+
+    for (int i = 0; i < fec->k; i++){
+        if (!g->recu[i]){
+            if (e == fec->m){
+                return 0; // trop de pertes pour ce groupe
+            }
+            manquants[e++] = i;
+        }
+    }
+    if (e == 0){
+        g->repare = 1;
+        return 0;
+    }
+    for (int j = 0; j < fec->m && p < e; j++){
+        if (g->recu[fec->k + j]){
+            parites[p++] = j;
+        }
+    }
+    if (p < e){
+        return 0;
+    }
+
+    // tout est vérifié avant de modifier les parités, qui doivent rester
+    // intactes si le groupe n'est pas réparé maintenant
+    int taille = g->taille[fec->k + parites[0]];
+    for (int r = 1; r < e; r++){
+        if (g->taille[fec->k + parites[r]] != taille){
+            return 0;
+        }
+    }
+
+    unsigned char a[FEC_M_MAX][FEC_M_MAX];
+    unsigned char inv[FEC_M_MAX][FEC_M_MAX];
+    for (int r = 0; r < e; r++){
+        for (int c = 0; c < e; c++){
+            a[r][c] = coefficient(fec, parites[r], manquants[c]);
+        }
+    }
+    if (inverser(a, inv, e) == -1){
+        return 0;
+    }
+
+    // second membre : parité moins la contribution des données reçues (en place)
+    for (int r = 0; r < e; r++){
+        unsigned char* s = g->symbole[fec->k + parites[r]];
+        for (int i = 0; i < fec->k; i++){
+            if (g->recu[i]){
+                int t = (g->taille[i] < taille) ? g->taille[i] : taille;
+                gf_region(s, g->symbole[i], coefficient(fec, parites[r], i), t);
+            }
+        }
+    }
+
+    int nb = 0;
+    for (int c = 0; c < e; c++){
+        int i = manquants[c];
+        reserver(&g->symbole[i], &g->capacite[i], taille);
+        memset(g->symbole[i], 0, taille);
+        for (int r = 0; r < e; r++){
+            gf_region(g->symbole[i], g->symbole[fec->k + parites[r]], inv[c][r], taille);
+        }
+
+        int entete = g->symbole[i][0] | (g->symbole[i][1] << 8);
+        int size = entete & FEC_TAILLE_MAX;
+        if (size > taille - 2){
+            continue; // symbole incohérent
+        }
+        g->recu[i] = 1;
+        g->taille[i] = size + 2;
+        repares[nb].seq = g->base + i;
+        repares[nb].data = (char *) g->symbole[i] + 2;
+        repares[nb].size = size;
+        repares[nb].segment = entete >> 13;
+        nb++;
+    }
+    g->repare = 1;
+    return nb;
+}
+
+int mic_tcp_fec_donnee(mic_tcp_fec* fec, unsigned int seq, const char* data, int size, unsigned char segment, fec_repare* repares)
+{
+    unsigned int base = seq - seq % fec->k;
+    fec_groupe* g = trouver_groupe(fec, base);
+    int i = seq - base;
+
+    if (g == NULL || g->repare || g->recu[i] || size > FEC_TAILLE_MAX){
+        return 0;
+    }
+
+    int entete = size | (segment << 13);
+    reserver(&g->symbole[i], &g->capacite[i], size + 2);
+    g->symbole[i][0] = entete & 0xff;
+    g->symbole[i][1] = entete >> 8;
+    memcpy(g->symbole[i] + 2, data, size);
+    g->taille[i] = size + 2;
+    g->recu[i] = 1;
+    return reparer(fec, g, repares);
+}
+
+int mic_tcp_fec_parite(mic_tcp_fec* fec, unsigned int base, int indice, const char* symbole, int size, fec_repare* repares)
+{
+    fec_groupe* g;
+
+    if (base % fec->k != 0 || indice < 0 || indice >= fec->m || size < 2){
+        return 0;
+    }
+    g = trouver_groupe(fec, base);
+    if (g == NULL || g->repare || g->recu[fec->k + indice]){
+        return 0;
+    }
+
+    reserver(&g->symbole[fec->k + indice], &g->capacite[fec->k + indice], size);
+    memcpy(g->symbole[fec->k + indice], symbole, size);
+    g->taille[fec->k + indice] = size;
+    g->recu[fec->k + indice] = 1;
+    return reparer(fec, g, repares);
+}
@@ -0,0 +1,317 @@
+#include <mictcp.h>
+#include <api/mictcp_core.h>
+#include <api/mictcp_emu.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/*
+ * Discrete-event simulation of mictcp, built with -DMICTCP_SIM: client
+ * and server run in one thread, the network is the emulator's release
+ * heap and time is virtual, so a point of the sweep runs as fast as the
+ * protocol code allows, and always the same way for the same seed.
+ * For every point (send window x loss rate x minimum RTO x congestion
+ * control), forks one process that opens n connections to itself, sends
+ * on each in turn for the simulated duration, then prints one JSON object
+ * per point, all in a JSON array on stdout.
+ *
+ * Usage: sim [-w windows] [-l loss%] [-R rto_min ms] [-c cc] [-n connections]
+ *            [-d seconds] [-s size] [-e emu] [-S seed]
+ * Lists are comma separated. The path is the MICTCP_EMU spec given by -e
+ * (delay=10 by default), both ways, with the loss and seed of the point.
+ * Sends are blocking, the send buffer and mic_tcp_poll are not simulated.
+ */
+
+#define SIM_LIST_MAX 16
+#define SIM_ACCEPT_USEC 1000 /* virtual time left to the handshake per accept attempt */
+#define SIM_ACCEPT_TRIES 10000
+
+typedef struct sim_config
+{
+    int window;
+    int loss;
+    unsigned long rto_min; /* usec, 0 = protocol default */
+    const char* cc;
+    int connections;
+    double duration;
+    int size;
+    const char* emu;
+    unsigned long seed;
+} sim_config;
+
+/* Written by the child of a point, read by the parent once it exited */
+typedef struct sim_result
+{
+    int errors;
+    unsigned long sent;
+    unsigned long delivered;
+    unsigned long delivered_bytes;
+    unsigned long retransmissions;
+    unsigned long datagrams;
+    unsigned long srtt;             /* mean over the connections, usec */
+    unsigned long start;            /* virtual usec */
+    unsigned long last_recv;
+    unsigned long end;              /* every connection closed */
+    double wall;                    /* seconds */
+} sim_result;
+
+static void quiet(void)
+{
+    /* The protocol logs on stdout, which carries the JSON */
+    int null = open("/dev/null", O_WRONLY);
+    if (null != -1) {
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+}
+
+static mic_tcp_sock_addr sim_addr(unsigned short port)
+{
+    mic_tcp_sock_addr addr;
+    addr.ip_addr.addr = "127.0.0.1";
+    addr.ip_addr.addr_size = strlen(addr.ip_addr.addr) + 1;
+    addr.port = port;
+    return addr;
+}
+
+static double wall_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Takes every message waiting on the server side */
+static void drain(const int* fds, int n, char* buffer, int size, sim_result* r)
+{
+    int i;
+    int got;
+
+    for (i = 0; i < n; i++) {
+        while ((got = mic_tcp_recv(fds[i], buffer, size)) > 0) {
+            r->delivered++;
+            r->delivered_bytes += got;
+            r->last_recv = get_now_time_usec();
+        }
+    }
+}
+
+static void run_simulation(const sim_config* cfg, sim_result* r)
+{
+    int* clients = malloc(cfg->connections * sizeof(int));
+    int* servers = malloc(cfg->connections * sizeof(int));
+    char* buffer = calloc(1, cfg->size);
+    char spec[256];
+    mic_tcp_sock_addr remote;
+    double wall = wall_now();
+    unsigned long stop;
+    int listener;
+    int i;
+
+    quiet();
+    snprintf(spec, sizeof(spec), "%s%sloss=%d,seed=%lu", cfg->emu, (cfg->emu[0] != '\0') ? "," : "", cfg->loss, cfg->seed);
+    setenv(EMU_ENV, spec, 1);
+
+    if ((listener = mic_tcp_socket(SERVER)) == -1 || mic_tcp_bind(listener, sim_addr(9000)) == -1) {
+        r->errors++;
+        exit(1);
+    }
+    mic_tcp_set_nonblocking(listener, 1);
+
+    for (i = 0; i < cfg->connections; i++) {
+        int tries = 0;
+
+        if ((clients[i] = mic_tcp_socket(CLIENT)) == -1
+            || (cfg->cc != NULL && mic_tcp_set_cc(clients[i], cfg->cc) == -1)
+            || (cfg->window > 0 && mic_tcp_set_send_window(clients[i], cfg->window) == -1)
+            || (cfg->rto_min > 0 && mic_tcp_set_rto_min(clients[i], cfg->rto_min) == -1)
+            || mic_tcp_connect(clients[i], sim_addr(9000)) == -1) {
+            r->errors++;
+            exit(1);
+        }
+        /* The last ACK of the handshake may still be on its way */
+        while ((servers[i] = mic_tcp_accept(listener, &remote)) == -1 && ++tries < SIM_ACCEPT_TRIES) {
+            wait_until_usec(get_now_time_usec() + SIM_ACCEPT_USEC);
+        }
+        if (servers[i] == -1) {
+            r->errors++;
+            exit(1);
+        }
+        mic_tcp_set_nonblocking(servers[i], 1);
+    }
+
+    r->start = get_now_time_usec();
+    stop = r->start + (unsigned long) (cfg->duration * 1e6);
+
+    /* One message on every connection, then the server reads what arrived */
+    while (get_now_time_usec() < stop) {
+        for (i = 0; i < cfg->connections; i++) {
+            if (mic_tcp_send(clients[i], buffer, cfg->size) == -1) {
+                r->errors++;
+                exit(1);
+            }
+            r->sent++;
+        }
+        drain(servers, cfg->connections, buffer, cfg->size, r);
+    }
+
+    /* flush waits until everything in flight is acknowledged or abandoned;
+       the counters go with the socket at close */
+    for (i = 0; i < cfg->connections; i++) {
+        mic_tcp_stats stats;
+        mic_tcp_flush(clients[i]);
+        drain(servers, cfg->connections, buffer, cfg->size, r);
+        if (mic_tcp_get_stats(clients[i], &stats) == 0) {
+            r->retransmissions += stats.retransmissions;
+            r->srtt += stats.srtt / cfg->connections;
+        }
+        mic_tcp_close(clients[i]);
+    }
+    get_send_stats(&r->datagrams);
+    r->end = get_now_time_usec();
+    r->wall = wall_now() - wall;
+    exit(0);
+}
+
+static void print_string(const char* s)
+{
+    if (s == NULL) {
+        printf("null");
+    } else {
+        printf("\"%s\"", s);
+    }
+}
+
+/* Runs one point of the sweep and prints its JSON object */
+static int run_point(const sim_config* cfg, sim_result* r)
+{
+    pid_t child;
+    int status;
+
+    memset(r, 0, sizeof(*r));
+    fflush(stdout);
+
+    if ((child = fork()) == 0) {
+        run_simulation(cfg, r);
+    }
+    /* A child that crashed or gave up counts as an error, whatever it wrote */
+    if (child == -1 || waitpid(child, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        if (r->errors == 0) {
+            r->errors = 1;
+        }
+    }
+
+    double simulated = (r->end > r->start) ? (r->end - r->start) / 1e6 : 0;
+    double transfer = (r->last_recv > r->start) ? (r->last_recv - r->start) / 1e6 : 0;
+
+    printf("  {\"window\": %d, \"loss\": %d, \"rto_min_ms\": %g, \"cc\": ", cfg->window, cfg->loss, cfg->rto_min / 1000.0);
+    print_string(cfg->cc);
+    printf(", \"connections\": %d, \"duration_s\": %g, \"size\": %d, \"emu\": ", cfg->connections, cfg->duration, cfg->size);
+    print_string(cfg->emu);
+    printf(", \"seed\": %lu,\n   \"errors\": %d, \"sent\": %lu, \"delivered\": %lu, \"goodput_mbit_s\": %.3f,"
+           " \"msg_per_s\": %.1f, \"retransmissions\": %lu, \"datagrams\": %lu, \"srtt_us\": %lu,\n",
+           cfg->seed, r->errors, r->sent, r->delivered,
+           (transfer > 0) ? r->delivered_bytes * 8 / transfer / 1e6 : 0,
+           (transfer > 0) ? r->delivered / transfer : 0,
+           r->retransmissions, r->datagrams, r->srtt);
+    printf("   \"simulated_s\": %.3f, \"wall_s\": %.3f, \"speedup\": %.1f}",
+           simulated, r->wall, (r->wall > 0) ? simulated / r->wall : 0);
+    return r->errors;
+}
+
+static int parse_list(char* arg, char** items)
+{
+    int n = 0;
+    char* save = NULL;
+    char* item;
+
+    for (item = strtok_r(arg, ",", &save); item != NULL && n < SIM_LIST_MAX; item = strtok_r(NULL, ",", &save)) {
+        items[n++] = item;
+    }
+    return n;
+}
+
+static void usage(const char* name, int status)
+{
+    fprintf((status == 0) ? stdout : stderr, "Usage: %s [-w windows] [-l loss%%] [-R rto_min ms] [-c cc] [-n connections]"
+            " [-d seconds] [-s size] [-e emu] [-S seed]\n", name);
+    exit(status);
+}
+
+int main(int argc, char* argv[])
+{
+    char default_windows[] = "1,8,32";
+    char default_losses[] = "0,1,5";
+    char default_rtos[] = "0";
+    char* windows[SIM_LIST_MAX];
+    char* losses[SIM_LIST_MAX];
+    char* rtos[SIM_LIST_MAX];
+    char* ccs[SIM_LIST_MAX] = { NULL };
+    int nb_windows = 0, nb_losses = 0, nb_rtos = 0, nb_ccs = 1;
+    sim_config cfg;
+    sim_result* r;
+    int first = 1;
+    int errors = 0;
+    int opt;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.connections = 1;
+    cfg.duration = 10;
+    cfg.size = 1000;
+    cfg.emu = "delay=10";
+    cfg.seed = 1;
+
+    while ((opt = getopt(argc, argv, "w:l:R:c:n:d:s:e:S:h")) != -1) {
+        switch (opt) {
+        case 'w': nb_windows = parse_list(optarg, windows); break;
+        case 'l': nb_losses = parse_list(optarg, losses); break;
+        case 'R': nb_rtos = parse_list(optarg, rtos); break;
+        case 'c': nb_ccs = parse_list(optarg, ccs); break;
+        case 'n': cfg.connections = atoi(optarg); break;
+        case 'd': cfg.duration = atof(optarg); break;
+        case 's': cfg.size = atoi(optarg); break;
+        case 'e': cfg.emu = optarg; break;
+        case 'S': cfg.seed = strtoul(optarg, NULL, 10); break;
+        case 'h': usage(argv[0], 0);
+        default: usage(argv[0], 1);
+        }
+    }
+    if (cfg.connections <= 0 || cfg.size <= 0 || cfg.duration <= 0) {
+        usage(argv[0], 1);
+    }
+    if (nb_windows == 0) nb_windows = parse_list(default_windows, windows);
+    if (nb_losses == 0) nb_losses = parse_list(default_losses, losses);
+    if (nb_rtos == 0) nb_rtos = parse_list(default_rtos, rtos);
+
+    r = mmap(NULL, sizeof(sim_result), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    printf("[\n");
+    for (int w = 0; w < nb_windows; w++) {
+        for (int l = 0; l < nb_losses; l++) {
+            for (int t = 0; t < nb_rtos; t++) {
+                for (int c = 0; c < nb_ccs; c++) {
+                    cfg.window = atoi(windows[w]);
+                    cfg.loss = atoi(losses[l]);
+                    cfg.rto_min = (unsigned long) (atof(rtos[t]) * 1000);
+                    cfg.cc = ccs[c];
+                    if (!first) {
+                        printf(",\n");
+                    }
+                    first = 0;
+                    errors += run_point(&cfg, r);
+                }
+            }
+        }
+    }
+    printf("\n]\n");
+    return errors != 0;
+}
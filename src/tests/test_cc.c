@@ -0,0 +1,76 @@
+#include <mictcp_cc.h>
+#include <stdio.h>
+
+/*
+ * Congestion control reaction to timeouts: a whole window timing out in
+ * one pass of the sender is one event, so each module reduces cwnd and
+ * ssthresh exactly once, and PDUs sent before that reaction expiring in a
+ * later pass do not reduce them again. A retransmission timing out is a
+ * new event.
+ *
+ * Usage: test_cc (exit status 0 on success)
+ */
+
+#define WINDOW 32
+#define RTT 20000 /* usec */
+
+static int failures = 0;
+
+static void check(const char* cc, const char* what, int ok)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL %s: %s\n", cc, what);
+        failures++;
+    }
+}
+
+/* Grows cwnd to WINDOW PDUs, then sends a full window at t = 1 s */
+static void fill_window(mic_tcp_cc* cc, const mic_tcp_cc_ops* ops)
+{
+    mic_tcp_cc_init(cc, ops);
+    while (cc->cwnd < WINDOW) {
+        mic_tcp_cc_ack(cc, 1, 0, RTT, 0);
+    }
+}
+
+static void test_module(const mic_tcp_cc_ops* ops)
+{
+    mic_tcp_cc cc;
+    mic_tcp_cc reference;
+    unsigned long sent = 1000000;
+    unsigned long now = sent + 5 * RTT;
+    unsigned int PE = WINDOW;
+
+    // the expected state after a single on_rto
+    fill_window(&reference, ops);
+    ops->on_rto(&reference, now);
+
+    // every PDU of the window expired in the same pass: one call
+    fill_window(&cc, ops);
+    mic_tcp_cc_expiration(&cc, sent, PE, now);
+    check(ops->nom, "cwnd reduced once for a full window", cc.cwnd == reference.cwnd);
+    check(ops->nom, "ssthresh reduced once for a full window", cc.ssthresh == reference.ssthresh);
+
+    // PDUs of the same window expiring in a later pass, and losses inside
+    // the recovery window, belong to the same event
+    mic_tcp_cc_expiration(&cc, sent + RTT / 2, PE, now + RTT);
+    mic_tcp_cc_perte(&cc, PE - 1, PE, now + RTT);
+    check(ops->nom, "later pass ignored", cc.cwnd == reference.cwnd && cc.ssthresh == reference.ssthresh);
+
+    // the retransmission, sent at the first reaction, expires too
+    ops->on_rto(&reference, now + 2 * RTT);
+    mic_tcp_cc_expiration(&cc, now, PE, now + 2 * RTT);
+    check(ops->nom, "expired retransmission reduces again", cc.cwnd == reference.cwnd && cc.ssthresh == reference.ssthresh);
+}
+
+int main(void)
+{
+    test_module(&cc_reno);
+    test_module(&cc_cubic);
+    test_module(&cc_fixe);
+
+    if (failures == 0) {
+        printf("test_cc: ok\n");
+    }
+    return failures != 0;
+}
@@ -0,0 +1,106 @@
+#include <api/mictcp_stats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Polls the counters a process exports with MICTCP_STATS=1.
+ * Usage: mictcp_stat <pid | stats file> [interval in seconds]
+ * Prints one line per socket; with an interval, prints again until the
+ * process exits.
+ */
+
+static const char* stats_path(const char* arg, char* buffer, size_t size)
+{
+    const char* dir = getenv(STATS_DIR_ENV);
+
+    if (strchr(arg, '/') != NULL || strstr(arg, ".bin") != NULL) {
+        return arg;
+    }
+    snprintf(buffer, size, "%s/mictcp-stats-%s.bin", (dir != NULL) ? dir : "/dev/shm", arg);
+    return buffer;
+}
+
+static void print_slots(const stats_file_header* hd)
+{
+    const stats_slot* slots = (const stats_slot*) (hd + 1);
+
+    printf("%4s %6s %6s %10s %12s %8s %8s %8s %8s %10s %10s %12s %8s %8s %8s %10s %8s %8s %6s\n",
+           "fd", "local", "remote", "pdu_tx", "bytes_tx", "retx", "tolere", "echeance", "parite", "acks_rx",
+           "pdu_rx", "bytes_rx", "doublon", "repare", "par_ign", "acks_tx", "srtt_us", "rto_us", "buffer");
+    for (unsigned int fd = 0; fd < hd->capacity; fd++) {
+        mic_tcp_stats s;
+
+        if (!__atomic_load_n(&slots[fd].used, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        stats_read(&slots[fd].stats, &s);
+        printf("%4u %6u %6u %10lu %12lu %8lu %8lu %8lu %8lu %10lu %10lu %12lu %8lu %8lu %8lu %10lu %8lu %8lu %6lu\n",
+               fd, __atomic_load_n(&slots[fd].local_port, __ATOMIC_RELAXED),
+               __atomic_load_n(&slots[fd].remote_port, __ATOMIC_RELAXED),
+               s.pdu_envoyes, s.octets_envoyes, s.retransmissions, s.pertes_tolerees, s.echeances_depassees,
+               s.parites_envoyees, s.acks_recus, s.pdu_recus, s.octets_recus, s.doublons, s.reparations,
+               s.parites_ignorees, s.acks_envoyes, s.srtt, s.rto, s.profondeur_buffer);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    char buffer[256];
+    const char* path;
+    struct stat st;
+    stats_file_header* hd;
+    double interval = 0;
+    int fd;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <pid | stats file> [interval in seconds]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2) {
+        interval = atof(argv[2]);
+    }
+    path = stats_path(argv[1], buffer, sizeof(buffer));
+
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        perror(path);
+        return 1;
+    }
+    if ((size_t) st.st_size < sizeof(stats_file_header)) {
+        fprintf(stderr, "%s: not a mictcp stats file\n", path);
+        return 1;
+    }
+    hd = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hd == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    if (memcmp(hd->magic, STATS_MAGIC, sizeof(hd->magic)) != 0 || hd->version != STATS_VERSION
+        || hd->slot_size != sizeof(stats_slot)
+        || (size_t) st.st_size < sizeof(stats_file_header) + hd->capacity * sizeof(stats_slot)) {
+        fprintf(stderr, "%s: not a mictcp stats file, or another version\n", path);
+        return 1;
+    }
+
+    while (1) {
+        print_slots(hd);
+        if (interval <= 0) {
+            break;
+        }
+        if (kill(hd->pid, 0) == -1 && errno == ESRCH) {
+            printf("process %d has exited\n", hd->pid);
+            break;
+        }
+        fflush(stdout);
+        usleep((useconds_t) (interval * 1e6));
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <api/mictcp_trace.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Offline decoder for the binary trace rings written by MICTCP_TRACE builds.
+ * Usage: trace_decode mictcp-trace-<pid>-<tid>.bin [...]
+ * Prints one line per event, all files merged in timestamp order.
+ */
+
+typedef struct decoded_event
+{
+    trace_event ev;
+    uint32_t tid;
+} decoded_event;
+
+static const char* event_names[TRACE_EVENT_MAX] = {
+    [TRACE_IP_SEND] = "IP_SEND",
+    [TRACE_IP_LOSS] = "IP_LOSS",
+    [TRACE_IP_RECV] = "IP_RECV",
+    [TRACE_PDU_SEND] = "PDU_SEND",
+    [TRACE_PDU_RETRANSMIT] = "PDU_RETRANSMIT",
+    [TRACE_PDU_ABANDON] = "PDU_ABANDON",
+    [TRACE_ACK_RECV] = "ACK_RECV",
+    [TRACE_PDU_RECV] = "PDU_RECV",
+    [TRACE_APP_DELIVER] = "APP_DELIVER",
+    [TRACE_FEC_PARITY] = "FEC_PARITY",
+    [TRACE_FEC_REPAIR] = "FEC_REPAIR",
+};
+
+static int compare_events(const void* a, const void* b)
+{
+    const decoded_event* ea = a;
+    const decoded_event* eb = b;
+    if (ea->ev.timestamp < eb->ev.timestamp) return -1;
+    return (ea->ev.timestamp > eb->ev.timestamp);
+}
+
+/* Append the events of one trace file to *events, oldest first */
+static int load_file(const char* path, decoded_event** events, size_t* count)
+{
+    trace_file_header hd;
+    FILE* fd = fopen(path, "rb");
+
+    if (fd == NULL) {
+        perror(path);
+        return -1;
+    }
+    if (fread(&hd, sizeof(hd), 1, fd) != 1 || memcmp(hd.magic, TRACE_MAGIC, sizeof(hd.magic)) != 0
+        || hd.version != TRACE_VERSION) {
+        fprintf(stderr, "%s: not a mictcp trace file\n", path);
+        fclose(fd);
+        return -1;
+    }
+
+    trace_event* ring = malloc(hd.capacity * sizeof(trace_event));
+    if (fread(ring, sizeof(trace_event), hd.capacity, fd) != hd.capacity) {
+        fprintf(stderr, "%s: truncated trace file\n", path);
+        free(ring);
+        fclose(fd);
+        return -1;
+    }
+    fclose(fd);
+
+    /* Once the ring has wrapped, only the last capacity events are left */
+    uint64_t first = (hd.head > hd.capacity) ? hd.head - hd.capacity : 0;
+    size_t n = hd.head - first;
+
+    *events = realloc(*events, (*count + n) * sizeof(decoded_event));
+    for (uint64_t i = first; i < hd.head; i++) {
+        decoded_event* d = &(*events)[(*count)++];
+        d->ev = ring[i % hd.capacity];
+        d->tid = hd.tid;
+    }
+
+    free(ring);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    decoded_event* events = NULL;
+    size_t count = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s trace-file [...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (load_file(argv[i], &events, &count) == -1) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    qsort(events, count, sizeof(decoded_event), compare_events);
+
+    printf("# timestamp_us tid event seq ack size\n");
+    for (size_t i = 0; i < count; i++) {
+        trace_event* e = &events[i].ev;
+        const char* name = (e->event < TRACE_EVENT_MAX && event_names[e->event] != NULL) ? event_names[e->event] : "UNKNOWN";
+        printf("%lu %u %s %u %u %u\n", (unsigned long) e->timestamp, events[i].tid, name, e->seq, e->ack, e->size);
+    }
+
+    free(events);
+    return EXIT_SUCCESS;
+}